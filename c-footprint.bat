@@ -0,0 +1,2 @@
+sdcc %* httppong.c
+python footprint.py httppong
@@ -0,0 +1,8 @@
+sdcc -DSTACK_LAYER=STACK_UART -o pingpong.ihx httppong.c
+packihx pingpong.ihx > pingpong.hex
+sdcc -DSTACK_LAYER=STACK_SLIP -o slippong.ihx httppong.c
+packihx slippong.ihx > slippong.hex
+sdcc -DSTACK_LAYER=STACK_IP -o ippong.ihx httppong.c
+packihx ippong.ihx > ippong.hex
+sdcc -DHTTP_SERVER=0 -DMODBUS_SERVER=1 -o tcppong.ihx httppong.c
+packihx tcppong.ihx > tcppong.hex
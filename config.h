@@ -0,0 +1,152 @@
+/**
+  config.h
+
+  Configuration of httppong.c. Every setting may be given on the
+  command line as well, e.g. sdcc -DSTACK_LAYER=3 httppong.c ;
+  whatever is not given takes the default below.
+*/
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+/* Layers of the stack, each one on top of the one before. */
+#define STACK_UART 1	/* Echo every character, 'i' as 'o': type "ping", get "pong". */
+#define STACK_SLIP 2	/* Echo every SLIP frame. */
+#define STACK_IP 3		/* Answer pings. */
+#define STACK_TCP 4		/* Answer pings, and serve the services below over TCP. */
+
+/* Highest layer compiled in; the layers above it are left out. */
+#ifndef STACK_LAYER
+#define STACK_LAYER STACK_TCP
+#endif
+
+/* Length of the UART buffers, a power of two up to 128. */
+#ifndef BUF_LENGTH
+#define BUF_LENGTH 0x10
+#endif
+
+#if BUF_LENGTH & (BUF_LENGTH-1) || BUF_LENGTH > 128
+#error BUF_LENGTH must be a power of two up to 128
+#endif
+
+/* Local IP address, 192.168.3.2. */
+#ifndef IP_LOCAL_ADDRESS_1
+#define IP_LOCAL_ADDRESS_1 192
+#endif
+#ifndef IP_LOCAL_ADDRESS_2
+#define IP_LOCAL_ADDRESS_2 168
+#endif
+#ifndef IP_LOCAL_ADDRESS_3
+#define IP_LOCAL_ADDRESS_3 3
+#endif
+#ifndef IP_LOCAL_ADDRESS_4
+#define IP_LOCAL_ADDRESS_4 2
+#endif
+
+/* Largest IP packet the SLIP link carries; 1006 bytes as in RFC 1055. */
+#ifndef SLIP_MTU
+#define SLIP_MTU 1006
+#endif
+
+/* HTTP server on port 80. Define as 0 to leave it out; then
+   MODBUS_SERVER has to be 1. */
+#ifndef HTTP_SERVER
+#define HTTP_SERVER (STACK_LAYER >= STACK_TCP)
+#endif
+
+/* Modbus/TCP server on port 502. Define as 1 to have it. */
+#ifndef MODBUS_SERVER
+#define MODBUS_SERVER 0
+#endif
+
+/* Number of TCP connections to keep track of, in XRAM.
+   With 0, the stack is stateless and needs no XRAM. */
+#ifndef TCP_CONNECTIONS
+#define TCP_CONNECTIONS 0
+#endif
+
+/* Secret for SYN cookies. Give every device its own one. */
+#ifndef TCP_COOKIE_SECRET
+#define TCP_COOKIE_SECRET 0x5EC2E7A5
+#endif
+
+/* Crystal frequency in Hz, for the uptime. */
+#ifndef CPU_CLOCK
+#define CPU_CLOCK 12000000
+#endif
+
+/* Number of pipelined HTTP requests answered at once. Without
+   a connection table the connection is closed after the answer,
+   so there is not much to gain from pipelining. */
+#ifndef HTTP_PIPELINE
+#if TCP_CONNECTIONS
+#define HTTP_PIPELINE 4
+#else
+#define HTTP_PIPELINE 1
+#endif
+#endif
+
+/* End HTTP pages with a few bytes which make up the checksum,
+   so that a segment ending a page is generated only once.
+   Define as 1 to have it. */
+#ifndef HTTP_SINGLE_PASS
+#define HTTP_SINGLE_PASS 0
+#endif
+
+/* Show the pins of the ports, the uptime and the number of requests
+   on the welcome page. Define as 1 to have them. */
+#ifndef HTTP_TEMPLATE
+#define HTTP_TEMPLATE 0
+#endif
+
+/* Answer a request for a single range of the welcome page with just
+   that range. Define as 1 to have it. The page must not change between
+   requests then, so it goes without HTTP_TEMPLATE and HTTP_SINGLE_PASS. */
+#ifndef HTTP_RANGE
+#define HTTP_RANGE 0
+#endif
+
+/* Count frames, drops and errors, and serve the counters at /metrics,
+   the values of the welcome page at /status.json. Define as 1 to have them. */
+#ifndef STATS
+#define STATS 0
+#endif
+
+/* Internal RAM, the top of the stack; 256 bytes on the 8052
+   and on most derivatives. */
+#ifndef IRAM_SIZE
+#define IRAM_SIZE 128
+#endif
+
+/* Histograms of the time the stages of a request take, served at
+   /metrics along with the counters. They are kept in XRAM, so they
+   need the connection table. Define as 1 to have them. */
+#ifndef TIMING
+#define TIMING 0
+#endif
+
+#if STACK_LAYER < STACK_UART || STACK_LAYER > STACK_TCP
+#error STACK_LAYER must be one of STACK_UART, STACK_SLIP, STACK_IP and STACK_TCP
+#endif
+
+#if STACK_LAYER >= STACK_TCP && !(HTTP_SERVER || MODBUS_SERVER)
+#error STACK_TCP needs HTTP_SERVER or MODBUS_SERVER
+#endif
+
+#if STACK_LAYER < STACK_TCP && (HTTP_SERVER || MODBUS_SERVER || TCP_CONNECTIONS)
+#error HTTP_SERVER, MODBUS_SERVER and TCP_CONNECTIONS need STACK_TCP
+#endif
+
+#if (HTTP_SINGLE_PASS || HTTP_TEMPLATE || HTTP_RANGE || STATS) && !HTTP_SERVER
+#error HTTP_SINGLE_PASS, HTTP_TEMPLATE, HTTP_RANGE and STATS need HTTP_SERVER
+#endif
+
+#if HTTP_RANGE && (HTTP_TEMPLATE || HTTP_SINGLE_PASS)
+#error HTTP_RANGE needs a welcome page which does not change: no HTTP_TEMPLATE, no HTTP_SINGLE_PASS
+#endif
+
+#if TIMING && !(STATS && TCP_CONNECTIONS)
+#error TIMING needs STATS and TCP_CONNECTIONS
+#endif
+
+#endif
@@ -0,0 +1,209 @@
+"""
+  footprint.py
+
+  Footprint of a program compiled with SDCC, symbol by symbol.
+
+  Usage: footprint.py [-s] name
+
+  Reads name.rst, name.map and name.mem, which SDCC leaves behind,
+  and prints the bytes of code, data, idata, bits and xdata of every
+  function and variable. A function counts its own local variables.
+  If name.base exists, the change against it is shown next to every
+  number; with -s, the footprint is saved as name.base instead.
+"""
+
+import os
+import re
+import sys
+
+COLUMNS = ("code", "data", "idata", "bits", "xdata")
+
+# Column of the areas SDCC places symbols in.
+AREAS = {
+	"CSEG": "code", "CONST": "code", "HOME": "code",
+	"DSEG": "data", "OSEG": "data",
+	"ISEG": "idata",
+	"BSEG": "bits",
+	"XSEG": "xdata", "PSEG": "xdata",
+}
+
+# Listing line: address, bytes, line number, source.
+RST_LINE = re.compile(r"^\s*([0-9A-F]{4})?((?:\s[0-9A-F]{2})*)\s+(\d+)\s(.*)$")
+RST_BYTES = re.compile(r"^\s*([0-9A-F]{4})?((?:\s[0-9A-F]{2})+)$")	# Continued from the line before.
+RST_AREA = re.compile(r"^\s*\.area\s+(\w+)")
+RST_FUNCTION = re.compile(r"^;\s+function\s+(\w+)")
+RST_LABEL = re.compile(r"^(_\w+)::?")
+RST_SPACE = re.compile(r"^\s*\.ds\s+(\d+)")
+
+LOCAL = re.compile(r"^(PARM_\d+|sloc\d+_\d+_\d+|\w+_\d+_\d+)$")
+
+MAP_AREA = re.compile(r"^(\w+)\s+[0-9A-F]{4}\s+[0-9A-F]{4}\s+=\s+(\d+)\.\s+bytes\s+\(([^)]*)\)")
+
+MEM_STACK = re.compile(r"Stack starts at: (0x[0-9A-Fa-f]+).*with (\d+) bytes available")
+MEM_OTHER = re.compile(r"^\s*(EXTERNAL RAM|ROM/EPROM/FLASH)\s+\S+\s+\S+\s+(\d+)\s+(\d+)")
+
+
+def symbols_of(rst):
+	"""Sum up the bytes of every symbol in the listing."""
+	symbols = {}
+	functions = []
+	area = None
+	symbol = None
+
+	for line in open(rst):
+		line = line.rstrip()
+		match = RST_LINE.match(line)
+		if not match:
+			match = RST_BYTES.match(line)
+			if match and symbol is not None and area == "code":
+				symbols[symbol]["code"] += len(match.group(2).split())
+			continue
+		source = match.group(4)
+
+		found = RST_AREA.match(source)
+		if found:
+			area = AREAS.get(found.group(1))
+			symbol = None
+			continue
+
+		found = RST_FUNCTION.match(source)
+		if found:
+			functions.append("_" + found.group(1))
+			continue
+
+		found = RST_LABEL.match(source)
+		if found and area:
+			symbol = found.group(1)
+			symbols.setdefault(symbol, dict.fromkeys(COLUMNS, 0))
+			continue
+
+		if symbol is None:
+			continue
+
+		if area == "code":
+			symbols[symbol]["code"] += len(match.group(2).split())
+		else:
+			found = RST_SPACE.match(source)
+			if found:
+				symbols[symbol][area] += int(found.group(1))
+
+	# Local variables are named after their function: _function_PARM_2,
+	# _function_variable_1_1 or _function_sloc0_1_0. Globals which merely
+	# start with the name of a function, such as _http_part_kind, stay.
+	functions.sort(key=len, reverse=True)
+	for name in list(symbols):
+		for function in functions:
+			if name.startswith(function + "_") and LOCAL.match(name[len(function) + 1:]) and function in symbols:
+				for column in COLUMNS:
+					symbols[function][column] += symbols[name][column]
+				del symbols[name]
+				break
+
+	return symbols
+
+
+def areas_of(map_file):
+	"""Sum up the areas of the whole program, libraries included."""
+	totals = dict.fromkeys(COLUMNS, 0)
+	seen = set()
+
+	for line in open(map_file):
+		match = MAP_AREA.match(line)
+		if not match or match.group(1) in seen:
+			continue
+		seen.add(match.group(1))
+		column = AREAS.get(match.group(1))
+		if column:
+			totals[column] += int(match.group(2))
+
+	return totals
+
+
+def memory_of(mem):
+	"""Read what the linker tells about the stack and the memories."""
+	lines = []
+
+	for line in open(mem):
+		match = MEM_STACK.search(line)
+		if match:
+			lines.append("Stack starts at %s, %s bytes available" % match.groups())
+		match = MEM_OTHER.match(line)
+		if match:
+			lines.append("%s: %s of %s bytes" % match.groups())
+
+	return lines
+
+
+def load(path):
+	table = {}
+
+	for line in open(path):
+		fields = line.split()
+		if len(fields) == len(COLUMNS) + 1:
+			table[fields[0]] = dict(zip(COLUMNS, map(int, fields[1:])))
+
+	return table
+
+
+def save(path, table):
+	out = open(path, "w")
+	for name in sorted(table):
+		out.write(name + "".join(" %d" % table[name][column] for column in COLUMNS) + "\n")
+	out.close()
+
+
+def cell(value, base):
+	if base is None or value == base:
+		return "%7d%6s" % (value, "")
+	return "%7d%+6d" % (value, value - base)
+
+
+def show(table, base):
+	print("%-36s" % "symbol" + "".join("%7s%6s" % (column, "") for column in COLUMNS))
+
+	# Largest code first, the total last.
+	names = sorted(set(table) | set(base or {}),
+	               key=lambda name: (name == "(total)", -table.get(name, {"code": 0})["code"]))
+	for name in names:
+		row = table.get(name, dict.fromkeys(COLUMNS, 0))
+		old = (base or {}).get(name)
+		if old is None and base is not None:
+			old = dict.fromkeys(COLUMNS, 0)
+		if not any(row.values()) and not (old and any(old.values())):
+			continue
+		print("%-36s" % name + "".join(cell(row[column], old and old[column]) for column in COLUMNS))
+
+
+def main(argv):
+	saving = "-s" in argv
+	argv = [arg for arg in argv if arg != "-s"]
+	if len(argv) != 1:
+		sys.stderr.write(__doc__)
+		return 1
+	name = argv[0]
+
+	table = symbols_of(name + ".rst")
+
+	# Startup code and library functions are not in the listing.
+	totals = areas_of(name + ".map")
+	rest = dict((column, totals[column] - sum(row[column] for row in table.values()))
+	            for column in COLUMNS)
+	table["(library)"] = dict((column, max(rest[column], 0)) for column in COLUMNS)
+	table["(total)"] = totals
+
+	if saving:
+		save(name + ".base", table)
+		print("Saved as " + name + ".base")
+		return 0
+
+	base = load(name + ".base") if os.path.exists(name + ".base") else None
+	show(table, base)
+	print("")
+	for line in memory_of(name + ".mem"):
+		print(line)
+
+	return 0
+
+
+if __name__ == "__main__":
+	sys.exit(main(sys.argv[1:]))
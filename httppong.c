@@ -29,15 +29,17 @@
 
   
   This is a very small HTTP server running on a 8051 controller.
-  The memory (IRAM) usage is 76 bytes, so the program is able to run
-  without externam RAM. ROM usage is of 2950 bytes, so any 8051 compatible
-  controller with ROM of 4kb or more may be used. Only the peripherals
-  every 8051 compatible controller has were used, so the resulting
-  hex-file should be binary compatible across the whole gross of the
-  8051 family.
+  The default build is meant to run without external RAM, in the
+  128 bytes of IRAM and the 4kb of ROM any 8051 compatible controller
+  has; the extras described below are compiled in only on request.
+  c-footprint.bat shows how many bytes of IRAM and ROM a build takes
+  indeed, see below. Only the peripherals every 8051 compatible
+  controller has were used, so the resulting hex-file should be
+  binary compatible across the whole gross of the 8051 family.
   
   Of the four banks of the 8051 banks 0 and 1 are used; bank 0 is used
-  for the main program and bank 1 is used for serial communication.
+  for the main program and bank 1 is used for serial communication
+  and the clock.
   Two bytes in the bit memory are used for, well, the bit memory.
   
   The inspiration and partly a source for this program was found
@@ -52,17 +54,100 @@
   that the controller sends back an answer, a "pong", to every
   TCP connection, the stage was named "tcppong.c". So "httppong"
   is the name for the last stage of development.
+  The stages are layers of httppong.c now, so that they share one copy
+  of the UART, SLIP, IP, ICMP and TCP code. config.h tells which layers
+  and services are compiled in; every setting there may be given
+  on the command line as well. -DSTACK_LAYER=STACK_UART echoes every
+  character typed, 'i' as 'o'; STACK_SLIP echoes every SLIP frame;
+  STACK_IP answers pings only; STACK_TCP, the default, adds TCP.
+  Compile with -DHTTP_SERVER=0 -DMODBUS_SERVER=1 to have Modbus/TCP
+  in place of HTTP. c-stages.bat builds the stages as pingpong.hex,
+  slippong.hex, ippong.hex and tcppong.hex.
+  Unlike the old tcppong.c, which answered a request on port 80 with
+  an empty segment, tcppong.hex is the TCP stack with Modbus/TCP alone.
+  Compile with -DIP_LOCAL_ADDRESS_1=a ... -DIP_LOCAL_ADDRESS_4=d
+  to give the controller another address than 192.168.3.2.
 
   ICMP protocol (i.e. ping) requests are supported.
+
+  Compiled with -DMODBUS_SERVER=1, Modbus/TCP requests on port 502
+  are supported, too. Function codes 1, 5 and 15 access the pins
+  of ports P0 to P3 as coils 0 to 31; function codes 3, 6 and 16
+  access holding registers 0 to 3, which are the ports P0 to P3,
+  and four general purpose registers behind them.
+  Writes never touch RXD and TXD; with the connection table, they leave
+  alone P0, P2, P3.6 and P3.7 as well, which are the bus of the XRAM.
   
-  The HTTP server is stateless, and the TCP/IP stack does not support
-  packet fragmentation. That means, that the HTTP request has to fit
-  into one packet; same goes for the HTTP answer and consequently
-  for the WWW page which server sends to the HTTP client.
+  By default the HTTP server is stateless, and the TCP/IP stack does
+  not support packet fragmentation. That means, that the HTTP request
+  has to fit into one segment; without the connection table below,
+  same goes for the HTTP answer and consequently for the WWW page
+  which server sends to the HTTP client. Answers which do not fit
+  are refused with 503 Service Unavailable.
+  Instead of a connection state, the initial sequence number sent
+  with SYN-ACK is a SYN cookie; a request is answered only if it
+  acknowledges a cookie issued during the last two minutes.
+  That goes for Modbus as well, so that a forged segment cannot write
+  the pins: a Modbus connection carries one request and is closed
+  after the answer, unless there is a connection table.
+  Parts with external RAM may be compiled with -DTCP_CONNECTIONS=n
+  to keep track of up to n connections in XRAM, 38 bytes each with
+  the extras left out; the least recently used connection makes room
+  for a new one. Then the answer may span several segments, Modbus
+  polls are checked against the connection they belong to, HTTP/1.1
+  connections are kept open for further requests and pipelined
+  requests are answered back to back.
+  Lost segments are sent again after a timeout which follows
+  the measured round trip time. The receive window is closed while
+  an answer is sent, and a client with a closed window is probed.
+  SYN-ACK advertises an MSS which fits into the SLIP MTU, 1006 bytes
+  unless compiled with -DSLIP_MTU=n; with the connection table,
+  no segment is larger than the MSS the client advertised.
+  Clients supporting TCP Fast Open get a cookie with SYN-ACK; a later
+  SYN bringing that cookie and an HTTP request is answered right away,
+  saving a round trip.
+  Compiled with -DHTTP_RANGE=1, a request with a single range in
+  a Range header gets just that range of the page with 206 Partial
+  Content, so that an interrupted download goes on where it stopped;
+  other ranges get the whole page. The parts of the page have to be
+  the same with every answer then, so this goes neither with
+  -DHTTP_TEMPLATE=1 nor with -DHTTP_SINGLE_PASS=1, whose values and
+  trailer differ from answer to answer.
+  Compiled with -DHTTP_TEMPLATE=1, the welcome page is a template
+  showing the pins of the ports, the uptime and the number of HTTP
+  requests, each as wide as it is. They are taken when a request is
+  answered, so that every segment and every retransmission of the
+  answer shows the same values. Compile with -DCPU_CLOCK=n if the
+  crystal does not run at 12 MHz, so that the uptime counts seconds.
+  For monitoring, compile with -DSTATS=1. Then GET /status.json
+  answers with the same values as a compact JSON object of fixed
+  schema, well below 100 bytes:
+  {"ports":[255,255,255,255],"uptime":86400,"requests":42}
+  The stack counts SLIP frames received, IP packets dropped for their
+  version, destination, checksum or protocol, TCP checksum errors, RSTs
+  sent, echo replies sent and characters lost to a full UART buffer.
+  GET /metrics shows the counters in the Prometheus text format,
+  along with the bytes of stack there are and the most ever used:
+  the stack is painted at reset, up to the end of IRAM at 128 bytes
+  unless compiled with -DIRAM_SIZE=n, and /metrics looks how far
+  the paint was overwritten. Without the connection table /metrics
+  has to fit into one segment, so the SLIP MTU has to be 926 bytes
+  at least; a build with a smaller one does not compile.
+  The counters take 20 bytes of RAM, and the notes on an answer grow
+  by 19 bytes, 29 without -DHTTP_TEMPLATE=1; the notes are kept
+  in RAM, and in XRAM with each connection.
+  With the connection table, -DTIMING=1 adds histograms of the machine
+  cycles spent waiting for a packet, receiving its headers, summing up
+  a segment for the checksum and sending it, taken from Timer0 and shown
+  at /metrics. They take 132 bytes of XRAM and 2 bytes of RAM; every
+  stage boundary costs the cycles shown as pong_timing_overhead_cycles,
+  which the controller measures at reset.
   Another peculiarity, attributed both to the need of low memory usage
   and to the statelessness of the HTTP server is that the data to be sent
   over HTTP is read twice, first time for checksum calculation and
-  second time for actual transfer.
+  second time for actual transfer. Only a segment ending a page is read
+  once: the page ends with a comment whose characters make up for
+  the checksum. Compile with -DHTTP_SINGLE_PASS=1 to have it.
 
   The function names in the source are pretty self-explanatory.
   For example, ip_rx2() means "receive 2 bytes using IP protocol".
@@ -73,13 +158,86 @@
 
 #include <mcs51/8051.h>
 #include <stdint.h>
+#include <stddef.h>
 
-#define BUF_LENGTH 0x10
+#include "config.h"
 
 /* Old XOR swap trick. */
 #define SWAP(a, b) { a ^= b; b ^= a; a ^= b; }
 
 
+/* Statistics counters. They wrap around at 65536, which Prometheus
+   takes for a restart. */
+#define STATS_FRAMES 0			/* SLIP frames received. */
+#define STATS_IP_VHL 1			/* IP packets dropped for their version or header length, */
+#define STATS_IP_DESTINATION 2	/* for their destination address, */
+#define STATS_IP_CHECKSUM 3		/* for their header checksum, */
+#define STATS_IP_PROTOCOL 4		/* for their protocol. */
+#define STATS_TCP_CHECKSUM 5	/* TCP segments dropped for their checksum. */
+#define STATS_TCP_RESETS 6		/* RSTs sent. */
+#define STATS_ICMP_REPLIES 7	/* Echo replies sent. */
+#define STATS_UART_OVERRUNS 8	/* Characters dropped with the receive buffer full. */
+
+#if STATS
+#define STATS_COUNTERS 9
+uint16_t stats[STATS_COUNTERS];
+#define STATS_COUNT(counter) stats[counter]++
+
+/* Set at the start of a frame, so that a packet is dropped for its
+   version only once, and not for every byte of it searched through. */
+bit stats_frame_start;
+
+/* The stack grows from above the variables up to the end of IRAM.
+   It is painted at reset, so that the bytes it ever reached show. */
+#define STATS_STACK_PAINT 0xA5
+uint8_t stats_stack_bottom;		/* Last byte below the stack. */
+uint8_t stats_stack_high_water;	/* Highest byte of the stack ever used. */
+
+/* Counters noted with an answer, then the stack used. */
+#define STATS_NOTES (STATS_COUNTERS*2 + 1)
+#else
+#define STATS_COUNTERS 0
+#define STATS_COUNT(counter)
+#define STATS_NOTES 0
+#endif
+
+/* Values the pages may show: the pins of the ports, the uptime
+   and the number of HTTP requests. */
+#define HTTP_VALUES (HTTP_TEMPLATE || STATS)
+/*-----------------------------------------------------------------------------------*/
+#if STATS
+/* Paint the stack above the caller. Call with interrupts disabled. */
+void stats_stack_paint(void)
+{
+	uint16_t i;
+
+	/* Leave out the return address of this call. */
+	stats_stack_bottom = SP - 2;
+	stats_stack_high_water = stats_stack_bottom;
+
+	/* 16 bits, so that the end of a 256 byte IRAM ends the loop too. */
+	for(i = SP + 1; i < IRAM_SIZE; i++)
+	{
+		*((__idata uint8_t *) i) = STATS_STACK_PAINT;
+	}
+}
+/*-----------------------------------------------------------------------------------*/
+/* Find the highest byte of the stack ever used; return the bytes used.
+   A byte pushed which looks like the paint may go unnoticed at the top. */
+uint8_t stats_stack_probe(void)
+{
+	uint8_t i;
+
+	for(i = IRAM_SIZE-1; i > stats_stack_high_water && *((__idata uint8_t *) i) == STATS_STACK_PAINT; i--)
+	{
+	}
+	stats_stack_high_water = i;
+
+	return stats_stack_high_water - stats_stack_bottom;
+}
+#endif
+
+
 /* UART communication infrastructure. */
 volatile unsigned char rx_buffer[BUF_LENGTH];
 volatile uint8_t rx_buffer_n = 0;
@@ -99,18 +257,6 @@ unsigned char serial_isr_rx(void) using 1
 	return c;
 }
 /*-----------------------------------------------------------------------------------*/
-unsigned char serial_rx(void) using 1
-{
-	if(rx_buffer_n > 0)
-	{
-		return serial_isr_rx();
-	}
-	else
-	{
-		return '\0';
-	}
-}
-/*-----------------------------------------------------------------------------------*/
 unsigned char serial_rx_waiting(void) using 1
 {
 	/* If no characters, wait. */
@@ -148,9 +294,16 @@ void serial_isr(void) interrupt SI0_VECTOR using 1
 	if(RI == 1)	/* Character was received. */
 	{
 		RI = 0;	/* Clear receiver flag. */
-		rx_buffer[rx_buffer_head] = SBUF;	/* Get character from UART. */
-		rx_buffer_head = (rx_buffer_head + 1) & (BUF_LENGTH-1);
-		rx_buffer_n++;
+		if(rx_buffer_n < BUF_LENGTH)	/* If buffer full, drop the character. */
+		{
+			rx_buffer[rx_buffer_head] = SBUF;	/* Get character from UART. */
+			rx_buffer_head = (rx_buffer_head + 1) & (BUF_LENGTH-1);
+			rx_buffer_n++;
+		}
+		else
+		{
+			STATS_COUNT(STATS_UART_OVERRUNS);
+		}
 	}
 	else	/* Character was transmitted. */
 	{
@@ -164,6 +317,7 @@ void serial_isr(void) interrupt SI0_VECTOR using 1
 	}
 }
 /*-----------------------------------------------------------------------------------*/
+#if STACK_LAYER >= STACK_SLIP
 void wait_for_slip_connection(void) using 1
 {
 	enum waiter_for_slip
@@ -239,8 +393,170 @@ void wait_for_slip_connection(void) using 1
  		}
 	}
 }
+#endif
+/*-----------------------------------------------------------------------------------*/
+
+/* Timer infrastructure. */
+
+#if STACK_LAYER >= STACK_TCP
+/* Timer0 overflows every 65536 machine cycles, i.e. every 65.5 ms @ 12 MHz. */
+volatile uint16_t timer_ticks = 0;
+
+#if HTTP_VALUES
+/* Seconds since reset. The remaining machine cycles are counted
+   in units of 64, which a second at 12 or 24 MHz is a whole number of. */
+#define TIMER_TICK_UNITS (65536/64)
+#define TIMER_SECOND_UNITS (CPU_CLOCK/12/64)
+volatile uint32_t timer_seconds = 0;
+uint16_t timer_units = 0;
+#endif
+/*-----------------------------------------------------------------------------------*/
+void timer_isr(void) interrupt TF0_VECTOR using 1
+{
+	timer_ticks++;
+
+#if HTTP_VALUES
+	timer_units += TIMER_TICK_UNITS;
+	if(timer_units >= TIMER_SECOND_UNITS)
+	{
+		timer_units -= TIMER_SECOND_UNITS;
+		timer_seconds++;
+	}
+#endif
+}
+#endif
+/*-----------------------------------------------------------------------------------*/
+#if STACK_LAYER >= STACK_TCP
+/* Read the clock; the interrupt may strike between its two bytes. */
+uint16_t timer_now(void)
+{
+	uint16_t now;
+
+	do
+	{
+		now = timer_ticks;
+	}
+	while(now != timer_ticks);
+
+	return now;
+}
+#endif
+/*-----------------------------------------------------------------------------------*/
+#if HTTP_VALUES
+uint32_t timer_uptime(void)
+{
+	uint32_t uptime;
+
+	do
+	{
+		uptime = timer_seconds;
+	}
+	while(uptime != timer_seconds);
+
+	return uptime;
+}
+#endif
+/*-----------------------------------------------------------------------------------*/
+
+/* Stage timing infrastructure. */
+
+/* Stages of a request: waiting for a packet, receiving and parsing
+   its headers, summing up a segment of the answer for the checksum,
+   and sending the rest of the segment out of the transmit ring. */
+#define TIMING_WAIT 0
+#define TIMING_HEADER 1
+#define TIMING_CHECKSUM 2
+#define TIMING_SEND 3
+#define TIMING_STAGES 4
+
+/* A stage takes less than 256 machine cycles, less than 4 times as
+   many, and so on up to 65536; the last bucket takes the rest. */
+#define TIMING_BUCKETS 6
+
+#if TIMING
+typedef struct timing_histogram_struct
+{
+	uint16_t counts[TIMING_BUCKETS];
+	uint32_t sum;		/* Machine cycles, wrapping around like the counts. */
+}
+timing_histogram;
+
+__xdata timing_histogram timing_histograms[TIMING_STAGES];
+
+/* Copy of the histograms the answers show. */
+__xdata timing_histogram timing_latched[TIMING_STAGES];
+
+/* When the stage being timed began. */
+__xdata uint32_t timing_begin;
+
+/* Machine cycles a stage boundary takes, measured at reset. */
+uint16_t timing_overhead;
+
+#define TIMING_START() timing_begin = timing_now()
+#define TIMING_STAGE(stage) timing_stage(stage)
+#else
+#define TIMING_START()
+#define TIMING_STAGE(stage)
+#endif
+/*-----------------------------------------------------------------------------------*/
+#if TIMING
+/* Read the clock down to the machine cycle. */
+uint32_t timing_now(void)
+{
+	uint16_t ticks;
+	uint8_t high;
+	uint8_t low;
+
+	do
+	{
+		ticks = timer_ticks;
+		high = TH0;
+		low = TL0;
+	}
+	while(high != TH0 || ticks != timer_ticks);
+
+	return ((uint32_t) ticks) << 16 | ((uint16_t) high) << 8 | low;
+}
+/*-----------------------------------------------------------------------------------*/
+/* End the stage, and begin the next one. */
+void timing_stage(uint8_t stage)
+{
+	uint32_t now = timing_now();
+	uint32_t cycles = now - timing_begin;
+	uint32_t rest;
+	uint8_t bucket = 0;
+
+	timing_begin = now;
+
+	for(rest = cycles >> 8; rest > 0 && bucket < TIMING_BUCKETS-1; rest >>= 2)
+	{
+		bucket++;
+	}
+
+	timing_histograms[stage].counts[bucket]++;
+	timing_histograms[stage].sum += cycles;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Time a stage boundary, which leaves a sample of its own behind. */
+void timing_measure(void)
+{
+	uint8_t i;
+
+	TIMING_START();
+	timing_stage(TIMING_WAIT);
+	timing_overhead = timing_now() - timing_begin;
+
+	for(i = 0; i < TIMING_BUCKETS; i++)
+	{
+		timing_histograms[TIMING_WAIT].counts[i] = 0;
+	}
+	timing_histograms[TIMING_WAIT].sum = 0;
+}
+#endif
 /*-----------------------------------------------------------------------------------*/
 
+#if STACK_LAYER >= STACK_SLIP
+
 /* SLIP infrastructure. */
 
 /* SLIP packet boundary. */
@@ -291,6 +607,24 @@ void slip_tx(unsigned char c)
     }
 }
 /*-----------------------------------------------------------------------------------*/
+#if STACK_LAYER >= STACK_IP
+/* Transfer characters which need no escaping, or are escaped already. */
+void slip_tx_frame(const unsigned char *frame, uint16_t length)
+{
+	if(slip_tx_state != SLIP_PACKET)
+	{
+		serial_tx(SLIP_END);
+		slip_tx_state = SLIP_PACKET;
+	}
+
+	while(length > 0)
+	{
+		serial_tx(*frame++);
+		length--;
+	}
+}
+#endif
+/*-----------------------------------------------------------------------------------*/
 #define start_packet end_packet
 void end_packet(void)
 {
@@ -312,6 +646,11 @@ unsigned char slip_decode(unsigned char c)
 		case SLIP_START:
 			if(c != SLIP_END)
 			{
+				STATS_COUNT(STATS_FRAMES);
+				TIMING_STAGE(TIMING_WAIT);
+#if STATS
+				stats_frame_start = 1;
+#endif
 				if(c != SLIP_ESC)
 				{
 					slip_rx_state = SLIP_PACKET;
@@ -360,30 +699,21 @@ unsigned char slip_decode(unsigned char c)
 	return '\0';
 }
 /*-----------------------------------------------------------------------------------*/
-unsigned char slip_rx(void)
+#if TCP_CONNECTIONS
+/* Take the frame boundaries received; return 1 if there is nothing else,
+   i.e. if the next packet has not begun yet. */
+uint8_t slip_rx_idle(void)
 {
-	unsigned char c;
-	
-	/* At least one character should be available. */
-	if(rx_buffer_n > 0)
+	while(rx_buffer_n > 0 && rx_buffer[rx_buffer_tail] == SLIP_END)
 	{
-		/* Try to decode one character. */
-		c = slip_decode(serial_rx());
-	
-		/* If one character is still needed and is available, decode it too. */
-		if(slip_rx_state != SLIP_PACKET && rx_buffer_n > 0)
-		{
-			c = slip_decode(serial_rx());
-		}
-		
-		/* Return result. */
-		return c;
+		slip_decode(serial_isr_rx());
 	}
-	
-	/* No result. */
-	return '\0';
+
+	return rx_buffer_n == 0;
 }
+#endif
 /*-----------------------------------------------------------------------------------*/
+#if STACK_LAYER >= STACK_IP
 unsigned char slip_rx_waiting(void)
 {
 	unsigned char c;
@@ -398,8 +728,12 @@ unsigned char slip_rx_waiting(void)
 		}
 	}
 }
+#endif
+#endif
 /*-----------------------------------------------------------------------------------*/
 
+#if STACK_LAYER >= STACK_IP
+
 /* IP infrastructure. */
 
 #define IP_HDR_VHL 0
@@ -427,6 +761,7 @@ unsigned char slip_rx_waiting(void)
 
 enum ip_proto
 {
+	IP_PROTO_NONE = 0,	/* Packet dropped. */
 	IP_PROTO_ICMP = 1,
 	IP_PROTO_TCP = 6
 }
@@ -436,10 +771,10 @@ uint16_t byte_number;
 
 uint16_t ip_packet_length;
 
-const uint8_t ip_local_address_1 = 192;
-const uint8_t ip_local_address_2 = 168;
-const uint8_t ip_local_address_3 = 3;
-const uint8_t ip_local_address_4 = 2;
+const uint8_t ip_local_address_1 = IP_LOCAL_ADDRESS_1;
+const uint8_t ip_local_address_2 = IP_LOCAL_ADDRESS_2;
+const uint8_t ip_local_address_3 = IP_LOCAL_ADDRESS_3;
+const uint8_t ip_local_address_4 = IP_LOCAL_ADDRESS_4;
 
 uint8_t ip_remote_address_1;
 uint8_t ip_remote_address_2;
@@ -504,7 +839,9 @@ uint16_t ip_rx2()
 /*-----------------------------------------------------------------------------------*/
 void ip_rx(void)
 {
-drop_ip_packet:
+#if STATS
+	uint8_t vhl;
+#endif
 
 	/* Reset variables. */
 	byte_number = 0;
@@ -512,7 +849,17 @@ drop_ip_packet:
 
 /* IP_HDR_VHL */
 	/* If packet is IPv4 and has no options, advance, else error. */
+#if STATS
+	vhl = ip_rx1();
+	if(vhl != 0x45 && stats_frame_start)
+	{
+		STATS_COUNT(STATS_IP_VHL);
+	}
+	stats_frame_start = 0;
+	if(vhl != 0x45)
+#else
 	if(ip_rx1() != 0x45)
+#endif
 	{
 		goto drop_ip_packet;
 	}
@@ -537,9 +884,14 @@ drop_ip_packet:
 
 /* IP_HDR_PROTO */
 	ip_packet_protocol = ip_rx1();
+#if STACK_LAYER >= STACK_TCP
 	if(ip_packet_protocol != IP_PROTO_ICMP &&
 	   ip_packet_protocol != IP_PROTO_TCP)
+#else
+	if(ip_packet_protocol != IP_PROTO_ICMP)
+#endif
 	{
+		STATS_COUNT(STATS_IP_PROTOCOL);
 		goto drop_ip_packet;
 	}
 
@@ -562,32 +914,41 @@ drop_ip_packet:
 /* IP_HDR_DESTADDR_1 */
 	if(ip_rx1() != ip_local_address_1)
 	{
+		STATS_COUNT(STATS_IP_DESTINATION);
 		goto drop_ip_packet;
 	}
 	
 /* IP_HDR_DESTADDR_2 */
 	if(ip_rx1() != ip_local_address_2)
 	{
+		STATS_COUNT(STATS_IP_DESTINATION);
 		goto drop_ip_packet;
 	}
 
 /* IP_HDR_DESTADDR_3 */
 	if(ip_rx1() != ip_local_address_3)
 	{
+		STATS_COUNT(STATS_IP_DESTINATION);
 		goto drop_ip_packet;
 	}
 	
 /* IP_HDR_DESTADDR_4 */
 	if(ip_rx1() != ip_local_address_4)
 	{
+		STATS_COUNT(STATS_IP_DESTINATION);
 		goto drop_ip_packet;
 	}
 
 	/* Check resulting checksum. */
-	if(resulting_checksum() != 0xFFFF)
+	if(resulting_checksum() == 0xFFFF)
 	{
-		goto drop_ip_packet;
+		return;
 	}
+	STATS_COUNT(STATS_IP_CHECKSUM);
+
+drop_ip_packet:
+	/* Nothing to process; the main loop goes on with the next packet. */
+	ip_packet_protocol = IP_PROTO_NONE;
 }
 /*-----------------------------------------------------------------------------------*/
 /* Transfer one byte. */
@@ -605,67 +966,107 @@ void ip_tx2(uint16_t i)
 	ip_tx1(i & 0xFF);
 }
 /*-----------------------------------------------------------------------------------*/
+/* The fixed fields of the IP header as they go over the line, escaped
+   for SLIP in advance, and their sum. Only length, protocol, checksum
+   and destination address are left to transfer one by one. */
+#define IP_TX_VHL 0x45	/* IPv4, IP header 5*4 bytes long. */
+#define IP_TX_TTL 0x80	/* No particular meaning for Time to Live field. */
+
+const unsigned char ip_tx_frame_vhl_tos[] =
+{
+	IP_TX_VHL,
+	0			/* TOS: nothing unusual. */
+};
+
+const unsigned char ip_tx_frame_ipid_ttl[] =
+{
+	0, 0,		/* IP ID: if every packet is smaller than 576 bytes, */
+				/* no fragmentation is needed. */
+	0, 0,		/* Same as for IP ID goes for flags and offset. */
+	IP_TX_TTL
+};
+
+/* The local address, escaped byte by byte. */
+#if IP_LOCAL_ADDRESS_1 == SLIP_END
+#define IP_TX_SOURCE_1 SLIP_ESC, SLIP_ESC_END
+#elif IP_LOCAL_ADDRESS_1 == SLIP_ESC
+#define IP_TX_SOURCE_1 SLIP_ESC, SLIP_ESC_ESC
+#else
+#define IP_TX_SOURCE_1 IP_LOCAL_ADDRESS_1
+#endif
+#if IP_LOCAL_ADDRESS_2 == SLIP_END
+#define IP_TX_SOURCE_2 SLIP_ESC, SLIP_ESC_END
+#elif IP_LOCAL_ADDRESS_2 == SLIP_ESC
+#define IP_TX_SOURCE_2 SLIP_ESC, SLIP_ESC_ESC
+#else
+#define IP_TX_SOURCE_2 IP_LOCAL_ADDRESS_2
+#endif
+#if IP_LOCAL_ADDRESS_3 == SLIP_END
+#define IP_TX_SOURCE_3 SLIP_ESC, SLIP_ESC_END
+#elif IP_LOCAL_ADDRESS_3 == SLIP_ESC
+#define IP_TX_SOURCE_3 SLIP_ESC, SLIP_ESC_ESC
+#else
+#define IP_TX_SOURCE_3 IP_LOCAL_ADDRESS_3
+#endif
+#if IP_LOCAL_ADDRESS_4 == SLIP_END
+#define IP_TX_SOURCE_4 SLIP_ESC, SLIP_ESC_END
+#elif IP_LOCAL_ADDRESS_4 == SLIP_ESC
+#define IP_TX_SOURCE_4 SLIP_ESC, SLIP_ESC_ESC
+#else
+#define IP_TX_SOURCE_4 IP_LOCAL_ADDRESS_4
+#endif
+
+const unsigned char ip_tx_frame_source[] =
+{
+	IP_TX_SOURCE_1,
+	IP_TX_SOURCE_2,
+	IP_TX_SOURCE_3,
+	IP_TX_SOURCE_4
+};
+
+/* Every term is 32 bits wide: SDCC shifts an int in 16 bits, and
+   TTL or an address byte above 0x7F would overflow into the sign. */
+#define IP_TX_FRAME_SUM (((uint32_t) IP_TX_VHL << 8) + ((uint32_t) IP_TX_TTL << 8) + \
+                         ((uint32_t) IP_LOCAL_ADDRESS_1 << 8 | IP_LOCAL_ADDRESS_2) + \
+                         ((uint32_t) IP_LOCAL_ADDRESS_3 << 8 | IP_LOCAL_ADDRESS_4))
+
+#if IP_LOCAL_ADDRESS_1 == 192 && IP_LOCAL_ADDRESS_2 == 168 && IP_LOCAL_ADDRESS_3 == 3 && IP_LOCAL_ADDRESS_4 == 2
+/* 0x4500 + 0x8000 + 0xC0A8 + 0x0302, summed up by hand for 192.168.3.2;
+   this does not compile if the compiler folds the sum otherwise. */
+typedef char ip_tx_frame_sum_check[(IP_TX_FRAME_SUM == 0x188AAUL) ? 1 : -1];
+#endif
+/*-----------------------------------------------------------------------------------*/
 void ip_tx()
 {
-	const uint8_t	ip_tx_vhl = 0x45;	/* IPv4, IP header 5*4 bytes long. */
-	const uint8_t	ip_tx_tos = 0;		/* Nothing unusual. */
-	const uint16_t	ip_tx_ipid = 0;		/* If every packet is smaller than 576 bytes, */
-										/* no fragmentation is needed. */
-	const uint16_t	ip_tx_offset = 0;	/* Same as for IP ID goes for flags and offset. */
-	const uint8_t	ip_tx_ttl = 0x80;	/* No particular meaning for Time to Live field. */
-	
-	/* Reset variables. */
+	/* Reset variables. The fixed fields are summed up already. */
 	byte_number = 0;
-	checksum = 0;
+	checksum = IP_TX_FRAME_SUM;
 	
 	start_packet();
 	
-	/* Transfer version and IP header length. */
-	ip_tx1(ip_tx_vhl);
-	
-	/* Transfer TOS field. */
-	ip_tx1(ip_tx_tos);
+	/* Transfer version, IP header length and TOS field. */
+	slip_tx_frame(ip_tx_frame_vhl_tos, sizeof(ip_tx_frame_vhl_tos));
+	byte_number = IP_HDR_LEN_1;
 	
 	/* Transfer IP packet length. */
 	ip_packet_length = ip_packet_length + IP_HEADER_LENGTH;
 	ip_tx2(ip_packet_length);
 	
-	/* Transfer IP ID. */
-	ip_tx2(ip_tx_ipid);
-	
-	/* Transfer IP offset and flags. */
-	ip_tx2(ip_tx_offset);
-	
-	/* Transfer TTL. */
-	ip_tx1(ip_tx_ttl);
+	/* Transfer IP ID, offset and flags, and TTL. */
+	slip_tx_frame(ip_tx_frame_ipid_ttl, sizeof(ip_tx_frame_ipid_ttl));
+	byte_number = IP_HDR_PROTO;
 	
 	/* Transfer protocol. */
 	ip_tx1(ip_packet_protocol);
 	
 	/* Calculate and transfer checksum. */
-	add_to_checksum(ip_local_address_1);
-	byte_number++;
-	add_to_checksum(ip_local_address_2);
-	byte_number--;
-	add_to_checksum(ip_local_address_3);
-	byte_number++;
-	add_to_checksum(ip_local_address_4);
-	byte_number--;
-	add_to_checksum(ip_remote_address_1);
-	byte_number++;
-	add_to_checksum(ip_remote_address_2);
-	byte_number--;
-	add_to_checksum(ip_remote_address_3);
-	byte_number++;
-	add_to_checksum(ip_remote_address_4);
-	byte_number--;
+	checksum += ((uint16_t) ip_remote_address_1) << 8 | ip_remote_address_2;
+	checksum += ((uint16_t) ip_remote_address_3) << 8 | ip_remote_address_4;
 	ip_tx2(~resulting_checksum());
 	
 	/* Transfer source address. */
-	ip_tx1(ip_local_address_1);
-	ip_tx1(ip_local_address_2);
-	ip_tx1(ip_local_address_3);
-	ip_tx1(ip_local_address_4);
+	slip_tx_frame(ip_tx_frame_source, sizeof(ip_tx_frame_source));
+	byte_number = IP_HDR_DESTADDR_1;
 	
 	/* Transfer destination address. */
 	ip_tx1(ip_remote_address_1);
@@ -741,6 +1142,8 @@ void icmp_rx(void)
 void icmp_tx(void)
 {
 	const uint16_t icmp_length = 8;
+
+	STATS_COUNT(STATS_ICMP_REPLIES);
 			
 	/* Specify IP content length. */
 	ip_packet_length = icmp_length;
@@ -777,8 +1180,11 @@ void icmp_tx(void)
  	/* End packet (SLIP). */
 	end_packet();
 }
+#endif
 /*-----------------------------------------------------------------------------------*/
 
+#if STACK_LAYER >= STACK_TCP
+
 /* TCP infrastructure. */
 
 #define TCP_HDR_SRCPORT_1 20
@@ -810,6 +1216,33 @@ void icmp_tx(void)
 #define TCP_FLAG_URG 0x20
 #define TCP_FLAGS 0x3F
 
+#define TCP_OPTION_END 0
+#define TCP_OPTION_NOP 1
+#define TCP_OPTION_MSS 2
+#define TCP_OPTION_MSS_LENGTH 4
+#define TCP_OPTION_FASTOPEN 34
+#define TCP_OPTION_FASTOPEN_LENGTH 6	/* With a cookie of four bytes. */
+
+/* Options sent with SYN at most: MSS, two NOPs and a Fast Open cookie. */
+#define TCP_SYN_OPTIONS_LENGTH (TCP_OPTION_MSS_LENGTH + 2 + TCP_OPTION_FASTOPEN_LENGTH)
+
+#define TCP_TX_HEADER_LENGTH 20
+
+/* Our MSS: the largest segment which fits into one SLIP packet. */
+#define TCP_MSS (SLIP_MTU - IP_HEADER_LENGTH - TCP_TX_HEADER_LENGTH)
+
+/* MSS of a client which does not tell its own (RFC 879). */
+#define TCP_DEFAULT_MSS 536
+
+/* Received data is processed while it arrives, one segment at a time.
+   While we transmit, the receive ring is all the room there is. */
+#define TCP_WINDOW TCP_MSS
+
+/* SYN cookies are valid for one to two epochs; an epoch is
+   1024 Timer0 overflows, i.e. 67 s @ 12 MHz. */
+#define TCP_COOKIE_EPOCH_SHIFT 10
+#define TCP_COOKIE_EPOCHS (0x10000 >> TCP_COOKIE_EPOCH_SHIFT)
+
 
 uint16_t tcp_local_port;
 uint16_t tcp_remote_port;
@@ -821,261 +1254,3176 @@ uint8_t tcp_flags;
 
 uint16_t tcp_data_length;
 
+#if TCP_CONNECTIONS
+/* MSS of the client. */
+uint16_t tcp_mss;
+
+/* Receive window to advertise, and the one advertised by the client. */
+uint16_t tcp_window;
+uint16_t tcp_remote_window;
+#else
+#define tcp_window TCP_WINDOW
+#endif
+
+#if TCP_CONNECTIONS
+/* Offset of the segment's data in the answer. */
+uint16_t tcp_data_offset;
+#else
+#define tcp_data_offset 0
+#endif
+
+/* Length of the TCP header being sent, options included. */
+uint8_t tcp_header_length;
+
+/* TCP Fast Open (RFC 7413): the SYN asks for a cookie,
+   or it brings a valid one and may carry a request. */
+bit tcp_fastopen_request;
+bit tcp_fastopen_valid;
+
 
 /* Interface to HTTP server. */
+#define HTTP_PORT 80
+
+/* Before a segment is sent, SNAPSHOT lets the server latch whatever
+   may change, so that CHECKSUM and SENDING see the same answer.
+   If the server returns non-zero, the segment ends with bytes which
+   make up for the checksum of the data; then CHECKSUM is skipped.
+   At CHECKSUM and SENDING the server hands out the data in tcp_run. */
 typedef enum server_stage_enum
 {
 	RECEIVING,
+	SNAPSHOT,
 	CHECKSUM,
 	SENDING
 }
 server_stage;
 
+#if HTTP_SERVER
+#define HTTP_NOTES (HTTP_PIPELINE+1 + (HTTP_RANGE ? 4 : 0) + (HTTP_VALUES ? 10 : 0) + STATS_NOTES)
+
 unsigned char http_server(server_stage,unsigned char);
+void http_accept(void);
+void http_withdraw(void);
+#endif
 
 /* End of interface to HTTP server. */
 
 
-void tcp_tx(void);
-/*-----------------------------------------------------------------------------------*/
-void add_pseudo_header_to_checksum()
-{
-	checksum += ((uint16_t) ip_local_address_1) << 8 | ip_local_address_2;
-	checksum += ((uint16_t) ip_local_address_3) << 8 | ip_local_address_4;
-	checksum += ((uint16_t) ip_remote_address_1) << 8 | ip_remote_address_2;
-	checksum += ((uint16_t) ip_remote_address_3) << 8 | ip_remote_address_4;
-	checksum += IP_PROTO_TCP;
-	checksum += (ip_packet_length-IP_HEADER_LENGTH);
-}
-/*-----------------------------------------------------------------------------------*/
-void tcp_rx(void)
-{
-	uint8_t data_offset = 40;
-	
-	/* Reinitialize TCP checksum. */
-	checksum = 0;
-	/* Add pseudo header. */
-	add_pseudo_header_to_checksum();
+#if MODBUS_SERVER
+/* Interface to Modbus server. */
+#define MODBUS_PORT 502
+#define MODBUS_NOTES 15
 
-/* TCP_HDR_SRCPORT_1
-   TCP_HDR_SRCPORT_2 */
-	tcp_remote_port = ip_rx2();
+unsigned char modbus_server(server_stage,unsigned char);
+void modbus_execute(void);
 
-/* TCP_HDR_DESTPORT_1
-   TCP_HDR_DESTPORT_2 */
-	tcp_local_port = ip_rx2();
+/* End of interface to Modbus server. */
+#endif
 
-/* TCP_HDR_SEQNO_1
-   TCP_HDR_SEQNO_2 */
-	tcp_seq = ((uint32_t) ip_rx2()) << 16;
 
-/* TCP_HDR_SEQNO_3
-   TCP_HDR_SEQNO_4 */
-	tcp_seq = tcp_seq | ip_rx2();
+/* Notes of the server on its answer, kept with the connection while
+   the answer is being sent. The server uses them as it likes. */
+#if HTTP_SERVER && !(MODBUS_SERVER && MODBUS_NOTES > HTTP_NOTES)
+#define TCP_NOTES HTTP_NOTES
+#else
+#define TCP_NOTES MODBUS_NOTES
+#endif
+uint8_t tcp_notes[TCP_NOTES];
 
-/* TCP_HDR_ACKNO_1
-   TCP_HDR_ACKNO_2 */
-	tcp_ack = ((uint32_t) ip_rx2()) << 16;
+/* Set by the server while receiving: close the connection after the answer. */
+bit tcp_close;
 
-/* TCP_HDR_ACKNO_3
-   TCP_HDR_ACKNO_4 */
-	tcp_ack = tcp_ack | ip_rx2();
+/* Data handed out by the server for CHECKSUM and SENDING, starting at
+   byte_number: a run of ROM, or a chunk the server fills with what it
+   generates. tcp_tx takes as much of it as fits into the segment. */
+#define TCP_CHUNK_LENGTH 4
+const unsigned char *tcp_run;
+uint16_t tcp_run_length;
+unsigned char tcp_chunk[TCP_CHUNK_LENGTH];
 
-/* TCP_HDR_OFFSET */
-	data_offset = (ip_rx1() >> 4) * 4 + IP_HEADER_LENGTH;
-	tcp_data_length = ip_packet_length - data_offset;
+/* Set by the server if its runs are text: they need no SLIP escaping. */
+bit tcp_run_text;
 
-/* TCP_HDR_FLAGS */
-	tcp_flags = ip_rx1() & TCP_FLAGS;
-	
-/* TCP_HDR_WINDOW_1
-   TCP_HDR_WINDOW_2 */
-	ip_rx2();
+/* At CHECKSUM the server may sum up a run itself, cut to the end of the
+   segment: tcp_run_sum is what it adds to the checksum at byte_number. */
+uint16_t tcp_run_sum;
+bit tcp_run_summed;
 
-/* TCP_HDR_CHKSUM_1
-   TCP_HDR_CHKSUM_2 */
-	ip_rx2();
 
-/* TCP_HDR_URGPTR_1
-   TCP_HDR_URGPTR_2 */
-	ip_rx2();
+/* Services, each bound to a local port. A segment to any other port is
+   not passed to a server at all, just checked and answered with RST. */
+#define TCP_SERVICE_NONE 0
+#define TCP_SERVICE_HTTP 1
+#define TCP_SERVICE_MODBUS 2
 
-	/* Discard TCP options. */
-	while(byte_number < data_offset)
-	{
-		ip_rx1();
-	}
+typedef struct tcp_binding_struct
+{
+	uint16_t port;
+	uint8_t service;
+}
+tcp_binding;
+
+/* To add a service, bind it here and pass it the characters in tcp_server(). */
+const tcp_binding tcp_bindings[] =
+{
+#if HTTP_SERVER
+	{HTTP_PORT, TCP_SERVICE_HTTP},
+#endif
+#if MODBUS_SERVER
+	{MODBUS_PORT, TCP_SERVICE_MODBUS},
+#endif
+};
 
-	/* Receive available data. */
-	while(byte_number < ip_packet_length)
+#define TCP_BINDINGS (sizeof(tcp_bindings)/sizeof(tcp_bindings[0]))
+
+/* Service of the segment being received or sent. */
+uint8_t tcp_service;
+
+
+void tcp_tx(void);
+/*-----------------------------------------------------------------------------------*/
+uint8_t tcp_cookie_epoch(void)
+{
+	return timer_now() >> TCP_COOKIE_EPOCH_SHIFT;
+}
+/*-----------------------------------------------------------------------------------*/
+uint32_t tcp_cookie_mix(uint32_t hash, uint8_t c)
+{
+	return ((hash << 5) + hash) ^ c;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Calculate the initial sequence number for the connection.
+   The epoch goes to the highest byte, a hash of the connection
+   and of the epoch goes to the three lower bytes. */
+uint32_t tcp_cookie(uint8_t epoch)
+{
+	uint32_t hash = TCP_COOKIE_SECRET;
+
+	hash = tcp_cookie_mix(hash, epoch);
+	hash = tcp_cookie_mix(hash, ip_remote_address_1);
+	hash = tcp_cookie_mix(hash, ip_remote_address_2);
+	hash = tcp_cookie_mix(hash, ip_remote_address_3);
+	hash = tcp_cookie_mix(hash, ip_remote_address_4);
+	hash = tcp_cookie_mix(hash, tcp_remote_port >> 8);
+	hash = tcp_cookie_mix(hash, tcp_remote_port & 0xFF);
+	hash = tcp_cookie_mix(hash, tcp_local_port >> 8);
+	hash = tcp_cookie_mix(hash, tcp_local_port & 0xFF);
+	hash = hash ^ (hash >> 16);
+
+	return ((uint32_t) epoch) << 24 | (hash & 0x00FFFFFF);
+}
+/*-----------------------------------------------------------------------------------*/
+/* Check whether the segment is the first one after a recent handshake. */
+uint8_t tcp_cookie_valid(void)
+{
+	uint32_t isn = tcp_ack - 1;
+	uint8_t epoch = isn >> 24;
+
+	if(((tcp_cookie_epoch() - epoch) & (TCP_COOKIE_EPOCHS-1)) > 1)
 	{
-		http_server(RECEIVING, ip_rx1());
+		return 0;
 	}
 
-	/* Check for correct TCP checksum. */
- 	if(resulting_checksum() != 0xFFFF)
- 	{
- 		return;
- 	}
+	return tcp_cookie(epoch) == isn;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Calculate the Fast Open cookie of the client, a hash of its address. */
+uint32_t tcp_fastopen_cookie(void)
+{
+	uint32_t hash = ~TCP_COOKIE_SECRET;
 
-	/* Process TCP request. */
-	if(tcp_local_port == 80)
-	{
-		if(tcp_flags == TCP_FLAG_SYN)
-		{
-			tcp_flags = TCP_FLAG_SYN | TCP_FLAG_ACK;
-			tcp_ack = tcp_seq + 1;
-			tcp_seq = 0xFFFFFFFF;
-			tcp_data_length = 0;
-			tcp_tx();
+	hash = tcp_cookie_mix(hash, ip_remote_address_1);
+	hash = tcp_cookie_mix(hash, ip_remote_address_2);
+	hash = tcp_cookie_mix(hash, ip_remote_address_3);
+	hash = tcp_cookie_mix(hash, ip_remote_address_4);
+
+	return hash;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Check whether the request sent along with the SYN is to be answered.
+   Only HTTP requests are, because a SYN sent again executes them again. */
+uint8_t tcp_fastopen(uint16_t segment_length)
+{
+	return tcp_fastopen_valid && segment_length > 0 && tcp_service == TCP_SERVICE_HTTP;
+}
+/*-----------------------------------------------------------------------------------*/
+#if !TCP_CONNECTIONS
+/* Answer a SYN. The SYN cookie replaces any connection state.
+   A request sent along with the SYN is answered at once and
+   the connection closed, if the answer fits into the SYN-ACK. */
+void tcp_syn_ack(uint16_t segment_length)
+{
+	tcp_flags = TCP_FLAG_SYN | TCP_FLAG_ACK;
+	tcp_ack = tcp_seq + 1;
+	tcp_seq = tcp_cookie(tcp_cookie_epoch());
+#if HTTP_SERVER
+	if(tcp_fastopen(segment_length))
+	{
+		http_accept();
+		if(tcp_data_length <= TCP_MSS - TCP_SYN_OPTIONS_LENGTH)
+		{
+			tcp_flags |= TCP_FLAG_PSH | TCP_FLAG_FIN;
+			tcp_ack += segment_length;
+		}
+		else
+		{
+			/* The client asks again after the handshake. */
+			http_withdraw();
+			tcp_data_length = 0;
+		}
+	}
+	else
+#endif
+	{
+		tcp_data_length = 0;
+	}
+	tcp_tx();
+}
+#endif
+/*-----------------------------------------------------------------------------------*/
+/* Look up the service bound to a local port. */
+uint8_t tcp_service_find(uint16_t port)
+{
+	uint8_t i;
+
+	for(i = 0; i < TCP_BINDINGS; i++)
+	{
+		if(tcp_bindings[i].port == port)
+		{
+			return tcp_bindings[i].service;
+		}
+	}
+
+	return TCP_SERVICE_NONE;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Pass the character to the server of the segment. */
+unsigned char tcp_server(server_stage stage, unsigned char c)
+{
+#if MODBUS_SERVER
+	if(tcp_service == TCP_SERVICE_MODBUS)
+	{
+		return modbus_server(stage, c);
+	}
+#endif
+
+#if HTTP_SERVER
+	return http_server(stage, c);
+#else
+	return '\0';
+#endif
+}
+/*-----------------------------------------------------------------------------------*/
+
+#if TCP_CONNECTIONS
+
+/* TCP connection table. */
+
+/* Retransmission timeouts in Timer0 overflows, i.e. in 65.5 ms @ 12 MHz. */
+#define TCP_RTO_INITIAL 16
+#define TCP_RTO_MIN 4
+#define TCP_RTO_MAX 1024
+
+/* Retransmissions before the connection is given up. */
+#define TCP_RETRIES 6
+
+/* Bits of the connection state. A free entry has state 0. */
+#define TCP_STATE_SYN_RECEIVED 0x01
+#define TCP_STATE_ESTABLISHED 0x02
+#define TCP_STATE_CLOSE 0x04		/* Close our side after the answer. */
+#define TCP_STATE_FIN_SENT 0x08
+#define TCP_STATE_FIN_RECEIVED 0x10
+
+/* Until the handshake is complete, our SYN takes one number
+   of the sequence space ahead of the answer. */
+#define TCP_SYN_LENGTH(conn) ((conn)->state & TCP_STATE_SYN_RECEIVED)
+
+typedef struct tcp_connection_struct
+{
+	uint8_t remote_address_1;
+	uint8_t remote_address_2;
+	uint8_t remote_address_3;
+	uint8_t remote_address_4;
+	uint16_t remote_port;
+	uint16_t local_port;
+	uint32_t snd_una;	/* Oldest unacknowledged sequence number. */
+	uint32_t snd_nxt;	/* Next sequence number to send. */
+	uint32_t rcv_nxt;	/* Next sequence number expected from the client. */
+	uint16_t offset;	/* Offset of snd_una in the answer. */
+	uint16_t length;	/* Length of the answer. */
+	uint16_t mss;		/* Largest segment we send. */
+	uint16_t window;	/* Window advertised by the client. */
+	uint8_t state;
+	uint8_t used;		/* Time of last use, for LRU eviction. */
+	uint16_t sent;		/* Timer0 ticks when the segment on its way was sent. */
+	uint8_t retries;	/* Retransmissions of the segment on its way. */
+	uint8_t notes[TCP_NOTES];
+}
+tcp_connection;
+
+__xdata tcp_connection tcp_connections[TCP_CONNECTIONS];
+__xdata tcp_connection *tcp_conn;
+uint8_t tcp_connections_clock;
+
+/* Round trip estimator of Jacobson and Karels. The smoothed round trip
+   time is scaled by 8, its variation by 4, everything in Timer0 ticks.
+   There is only one serial line, so all connections share it. */
+uint16_t tcp_srtt = 0;
+uint16_t tcp_rttvar = 0;
+uint16_t tcp_rto = TCP_RTO_INITIAL;
+
+/*-----------------------------------------------------------------------------------*/
+/* Find the connection the received segment belongs to. */
+uint8_t tcp_connection_match(__xdata tcp_connection *conn)
+{
+	return conn->state != 0 &&
+	       conn->remote_port == tcp_remote_port &&
+	       conn->local_port == tcp_local_port &&
+	       conn->remote_address_4 == ip_remote_address_4 &&
+	       conn->remote_address_3 == ip_remote_address_3 &&
+	       conn->remote_address_2 == ip_remote_address_2 &&
+	       conn->remote_address_1 == ip_remote_address_1;
+}
+/*-----------------------------------------------------------------------------------*/
+__xdata tcp_connection *tcp_connection_find(void)
+{
+	__xdata tcp_connection *conn;
+
+	for(conn = tcp_connections; conn < tcp_connections + TCP_CONNECTIONS; conn++)
+	{
+		if(tcp_connection_match(conn))
+		{
+			return conn;
+		}
+	}
+
+	return NULL;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Take a free entry, or evict the least recently used connection. */
+__xdata tcp_connection *tcp_connection_new(void)
+{
+	__xdata tcp_connection *conn;
+	__xdata tcp_connection *oldest = tcp_connections;
+
+	for(conn = tcp_connections; conn < tcp_connections + TCP_CONNECTIONS; conn++)
+	{
+		if(conn->state == 0)
+		{
+			oldest = conn;
+			break;
+		}
+
+		if((uint8_t) (tcp_connections_clock - conn->used) >
+		   (uint8_t) (tcp_connections_clock - oldest->used))
+		{
+			oldest = conn;
+		}
+	}
+
+	oldest->remote_address_1 = ip_remote_address_1;
+	oldest->remote_address_2 = ip_remote_address_2;
+	oldest->remote_address_3 = ip_remote_address_3;
+	oldest->remote_address_4 = ip_remote_address_4;
+	oldest->remote_port = tcp_remote_port;
+	oldest->local_port = tcp_local_port;
+	oldest->offset = 0;
+	oldest->length = 0;
+	oldest->mss = TCP_DEFAULT_MSS;
+
+	return oldest;
+}
+/*-----------------------------------------------------------------------------------*/
+void tcp_rtt_measured(uint16_t rtt)
+{
+	int16_t delta;
+
+	/* The clock is coarse; count a started tick as a whole one. */
+	rtt++;
+
+	if(tcp_srtt == 0)
+	{
+		tcp_srtt = rtt << 3;
+		tcp_rttvar = rtt << 1;
+	}
+	else
+	{
+		delta = rtt - (tcp_srtt >> 3);
+		tcp_srtt += delta;
+		if(delta < 0)
+		{
+			delta = -delta;
+		}
+		delta -= tcp_rttvar >> 2;
+		tcp_rttvar += delta;
+	}
+
+	/* RTO = SRTT + 4 * RTTVAR */
+	tcp_rto = (tcp_srtt >> 3) + tcp_rttvar;
+	if(tcp_rto < TCP_RTO_MIN)
+	{
+		tcp_rto = TCP_RTO_MIN;
+	}
+	else if(tcp_rto > TCP_RTO_MAX)
+	{
+		tcp_rto = TCP_RTO_MAX;
+	}
+}
+/*-----------------------------------------------------------------------------------*/
+/* Check whether there is something to send and nothing on its way. */
+uint8_t tcp_connection_pending(void)
+{
+	return tcp_conn->snd_nxt == tcp_conn->snd_una + TCP_SYN_LENGTH(tcp_conn) &&
+	       (tcp_conn->offset != tcp_conn->length ||
+	        (tcp_conn->state & (TCP_STATE_CLOSE | TCP_STATE_FIN_SENT)) == TCP_STATE_CLOSE);
+}
+/*-----------------------------------------------------------------------------------*/
+/* Send the next segment of the answer, or just an acknowledgement if
+   a segment is still on its way. The answer is generated again by offset. */
+void tcp_connection_tx(void)
+{
+	uint8_t i;
+	uint16_t limit;
+
+	tcp_flags = TCP_FLAG_ACK;
+	tcp_seq = tcp_conn->snd_nxt;
+	tcp_ack = tcp_conn->rcv_nxt;
+	if(tcp_conn->state & TCP_STATE_SYN_RECEIVED)
+	{
+		/* SYN-ACK, with the answer to a request sent along with the SYN. */
+		tcp_flags |= TCP_FLAG_SYN;
+		tcp_seq = tcp_conn->snd_una;
+	}
+	tcp_data_offset = tcp_conn->offset;
+	tcp_data_length = 0;
+	tcp_window = TCP_WINDOW;
+
+	for(i = 0; i < TCP_NOTES; i++)
+	{
+		tcp_notes[i] = tcp_conn->notes[i];
+	}
+
+	if(tcp_connection_pending())
+	{
+		tcp_data_length = tcp_conn->length - tcp_conn->offset;
+		/* The options of a SYN-ACK take room from the segment,
+		   but not from the window of the client. */
+		limit = tcp_conn->mss;
+		if(tcp_flags & TCP_FLAG_SYN)
+		{
+			limit = limit > TCP_SYN_OPTIONS_LENGTH ? limit - TCP_SYN_OPTIONS_LENGTH : 0;
+		}
+		if(tcp_conn->window < limit)
+		{
+			/* A closed window is probed with a single byte. */
+			limit = tcp_conn->window ? tcp_conn->window : 1;
+		}
+		if(tcp_data_length > limit)
+		{
+			tcp_data_length = limit;
+		}
+		else if(tcp_conn->state & TCP_STATE_CLOSE)
+		{
+			tcp_flags |= TCP_FLAG_FIN;
+			tcp_conn->state |= TCP_STATE_FIN_SENT;
+		}
+
+		if(tcp_data_length > 0)
+		{
+			tcp_flags |= TCP_FLAG_PSH;
+		}
+
+		tcp_conn->snd_nxt += tcp_data_length + (tcp_flags & TCP_FLAG_FIN);
+		tcp_conn->sent = timer_now();
+	}
+
+	/* Keep the window closed while more of the answer is to be sent,
+	   so that pipelined requests do not overrun the receive ring. */
+	if(tcp_conn->offset + (uint16_t) (tcp_conn->snd_nxt - tcp_conn->snd_una) -
+	   TCP_SYN_LENGTH(tcp_conn) < tcp_conn->length)
+	{
+		tcp_window = 0;
+	}
+
+	tcp_tx();
+}
+/*-----------------------------------------------------------------------------------*/
+/* Take the request just received; its answer is to be sent next. */
+void tcp_connection_request(uint16_t segment_length)
+{
+	uint8_t i;
+
+#if HTTP_SERVER
+	if(tcp_service == TCP_SERVICE_HTTP)
+	{
+		http_accept();
+	}
+#endif
+	tcp_conn->rcv_nxt += segment_length;
+	tcp_conn->offset = 0;
+	tcp_conn->length = tcp_data_length;
+	for(i = 0; i < TCP_NOTES; i++)
+	{
+		tcp_conn->notes[i] = tcp_notes[i];
+	}
+	if(tcp_close)
+	{
+		tcp_conn->state |= TCP_STATE_CLOSE;
+	}
+#if MODBUS_SERVER
+	if(tcp_service == TCP_SERVICE_MODBUS)
+	{
+		modbus_execute();
+	}
+#endif
+}
+/*-----------------------------------------------------------------------------------*/
+/* Header prediction: the next request on the connection seen last, with
+   nothing of ours outstanding, goes straight to its answer. Anything else
+   is left to tcp_connection_rx(). */
+uint8_t tcp_connection_predicted(uint16_t segment_length)
+{
+	if(segment_length == 0 || tcp_conn == NULL ||
+	   tcp_conn->state != TCP_STATE_ESTABLISHED ||
+	   !tcp_connection_match(tcp_conn) ||
+	   tcp_seq != tcp_conn->rcv_nxt ||
+	   tcp_ack != tcp_conn->snd_nxt ||
+	   tcp_conn->snd_nxt != tcp_conn->snd_una ||
+	   tcp_conn->offset != tcp_conn->length)
+	{
+		return 0;
+	}
+
+	tcp_conn->used = ++tcp_connections_clock;
+	tcp_conn->window = tcp_remote_window;
+	tcp_connection_request(segment_length);
+	tcp_connection_tx();
+	return 1;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Send the oldest unacknowledged segment of a connection again when its
+   retransmission timeout has passed. Called between received packets. */
+void tcp_timer(void)
+{
+	__xdata tcp_connection *conn;
+	uint16_t now = timer_now();
+	uint16_t rto;
+
+	for(conn = tcp_connections; conn < tcp_connections + TCP_CONNECTIONS; conn++)
+	{
+		if(conn->state == 0 || conn->snd_nxt == conn->snd_una)
+		{
+			continue;
+		}
+
+		/* Back off exponentially, but saturate before the shift overflows. */
+		if(tcp_rto > (TCP_RTO_MAX >> conn->retries))
+		{
+			rto = TCP_RTO_MAX;
+		}
+		else
+		{
+			rto = tcp_rto << conn->retries;
+		}
+		if((uint16_t) (now - conn->sent) < rto)
+		{
+			continue;
+		}
+
+		/* A client with a closed window is probed for as long as it takes. */
+		if(conn->retries == TCP_RETRIES)
+		{
+			if(conn->window != 0)
+			{
+				conn->state = 0;
+				continue;
+			}
+		}
+		else
+		{
+			conn->retries++;
+		}
+
+		tcp_conn = conn;
+		ip_remote_address_1 = conn->remote_address_1;
+		ip_remote_address_2 = conn->remote_address_2;
+		ip_remote_address_3 = conn->remote_address_3;
+		ip_remote_address_4 = conn->remote_address_4;
+		tcp_remote_port = conn->remote_port;
+		tcp_local_port = conn->local_port;
+		tcp_service = tcp_service_find(tcp_local_port);
+		ip_packet_protocol = IP_PROTO_TCP;
+		tcp_fastopen_request = 0;
+
+		/* Go back to the oldest unacknowledged data and generate it again.
+		   The timeout starts anew even if there is just the SYN-ACK to send. */
+		conn->snd_nxt = conn->snd_una + TCP_SYN_LENGTH(conn);
+		conn->state &= ~TCP_STATE_FIN_SENT;
+		conn->sent = now;
+		tcp_connection_tx();
+		return;
+	}
+}
+/*-----------------------------------------------------------------------------------*/
+void tcp_connection_rx(uint16_t segment_length, uint8_t fin)
+{
+	uint32_t acked;
+
+	tcp_conn = tcp_connection_find();
+
+	if(tcp_flags == TCP_FLAG_SYN)
+	{
+		if(tcp_conn == NULL)
+		{
+			tcp_conn = tcp_connection_new();
+		}
+		tcp_conn->used = ++tcp_connections_clock;
+		tcp_conn->state = TCP_STATE_SYN_RECEIVED;
+		tcp_conn->offset = 0;
+		tcp_conn->length = 0;
+		tcp_conn->rcv_nxt = tcp_seq + 1;
+		tcp_conn->mss = tcp_mss < TCP_MSS ? tcp_mss : TCP_MSS;
+		tcp_conn->window = tcp_remote_window;
+		tcp_conn->snd_una = tcp_cookie(tcp_cookie_epoch());
+		tcp_conn->snd_nxt = tcp_conn->snd_una + 1;
+		tcp_conn->sent = timer_now();
+		tcp_conn->retries = 0;
+		if(tcp_fastopen(segment_length))
+		{
+			tcp_connection_request(segment_length);
+		}
+		tcp_connection_tx();
+		return;
+	}
+
+	if(tcp_conn == NULL)
+	{
+		if(segment_length == 0 && !fin)
+		{
+			return;
+		}
+
+		if(tcp_cookie_valid())
+		{
+			/* The SYN cookie stands in for the handshake
+			   of a connection which was evicted from the table. */
+			tcp_conn = tcp_connection_new();
+			tcp_conn->state = TCP_STATE_ESTABLISHED;
+			tcp_conn->snd_una = tcp_ack;
+			tcp_conn->snd_nxt = tcp_ack;
+			tcp_conn->rcv_nxt = tcp_seq;
+			tcp_conn->retries = 0;
 		}
-		else if(tcp_ack == 0 && tcp_data_length > 0)
+		else if(segment_length > 0)
 		{
-			tcp_flags = TCP_FLAG_ACK | TCP_FLAG_PSH | TCP_FLAG_FIN;
-			tcp_ack = tcp_seq + tcp_data_length;
-			tcp_seq = 0;
+			/* Data for an unknown connection. */
+			tcp_flags = TCP_FLAG_RST;
+			tcp_seq = tcp_ack;
+			tcp_data_length = 0;
 			tcp_tx();
+			return;
 		}
-		else if(tcp_data_length > 0)
+		else
 		{
+			/* FIN of a connection closed already. */
 			tcp_flags = TCP_FLAG_ACK;
 			SWAP(tcp_ack, tcp_seq);
-			tcp_ack += tcp_data_length;
-			tcp_data_length = 0;
+			tcp_ack += fin;
 			tcp_tx();
+			return;
+		}
+	}
+
+	tcp_conn->used = ++tcp_connections_clock;
+	tcp_conn->window = tcp_remote_window;
+
+	/* Take acknowledged data off the answer. */
+	acked = tcp_ack - tcp_conn->snd_una;
+	if((tcp_flags & TCP_FLAG_ACK) && acked > 0 &&
+	   acked <= tcp_conn->snd_nxt - tcp_conn->snd_una)
+	{
+		if(tcp_conn->state & TCP_STATE_SYN_RECEIVED)
+		{
+			tcp_conn->state ^= TCP_STATE_SYN_RECEIVED | TCP_STATE_ESTABLISHED;
+			acked--;
+		}
+		/* Anything beyond the answer is our FIN. */
+		if(acked > tcp_conn->length - tcp_conn->offset)
+		{
+			acked = tcp_conn->length - tcp_conn->offset;
 		}
+		tcp_conn->offset += acked;
+		tcp_conn->snd_una = tcp_ack;
+
+		/* Measure only segments sent once (Karn's algorithm). */
+		if(tcp_conn->retries == 0)
+		{
+			tcp_rtt_measured(timer_now() - tcp_conn->sent);
+		}
+		tcp_conn->retries = 0;
+	}
+
+	/* Nothing but the ACK of the SYN-ACK is accepted before the handshake is complete. */
+	if(tcp_conn->state & TCP_STATE_SYN_RECEIVED)
+	{
+		return;
+	}
+
+	if(segment_length > 0 || fin)
+	{
+		if(tcp_seq == tcp_conn->rcv_nxt)
+		{
+			/* Take a new request only when the last one is answered.
+			   Otherwise the client will send it again later. */
+			if(segment_length > 0 && tcp_conn->offset == tcp_conn->length &&
+			   !(tcp_conn->state & TCP_STATE_CLOSE))
+			{
+				tcp_connection_request(segment_length);
+			}
+
+			if(fin && tcp_seq + segment_length == tcp_conn->rcv_nxt)
+			{
+				tcp_conn->rcv_nxt++;
+				tcp_conn->state |= TCP_STATE_FIN_RECEIVED | TCP_STATE_CLOSE;
+			}
+		}
+		else if(tcp_conn->snd_nxt != tcp_conn->snd_una)
+		{
+			/* The client repeats itself, so our last segment got lost. Send it again. */
+			tcp_conn->snd_nxt = tcp_conn->snd_una;
+			tcp_conn->state &= ~TCP_STATE_FIN_SENT;
+			tcp_conn->retries++;
+		}
+
+		tcp_connection_tx();
+	}
+	else if(tcp_connection_pending())
+	{
+		tcp_connection_tx();
+	}
+
+	/* Forget the connection when both sides are closed. */
+	if((tcp_conn->state & (TCP_STATE_FIN_SENT | TCP_STATE_FIN_RECEIVED)) ==
+	   (TCP_STATE_FIN_SENT | TCP_STATE_FIN_RECEIVED) &&
+	   tcp_conn->snd_una == tcp_conn->snd_nxt)
+	{
+		tcp_conn->state = 0;
+	}
+}
+
+#endif
+/*-----------------------------------------------------------------------------------*/
+void add_pseudo_header_to_checksum()
+{
+	checksum += ((uint16_t) ip_local_address_1) << 8 | ip_local_address_2;
+	checksum += ((uint16_t) ip_local_address_3) << 8 | ip_local_address_4;
+	checksum += ((uint16_t) ip_remote_address_1) << 8 | ip_remote_address_2;
+	checksum += ((uint16_t) ip_remote_address_3) << 8 | ip_remote_address_4;
+	checksum += IP_PROTO_TCP;
+	checksum += (ip_packet_length-IP_HEADER_LENGTH);
+}
+/*-----------------------------------------------------------------------------------*/
+void tcp_rx(void)
+{
+	uint8_t data_offset = 40;
+	uint16_t segment_length;
+	uint8_t fin;
+	uint8_t option;
+	uint8_t option_length;
+	uint32_t cookie;
+	uint8_t predicted;
+	
+	/* Reinitialize TCP checksum. */
+	checksum = 0;
+	/* Add pseudo header. */
+	add_pseudo_header_to_checksum();
+
+/* TCP_HDR_SRCPORT_1
+   TCP_HDR_SRCPORT_2 */
+	tcp_remote_port = ip_rx2();
+
+/* TCP_HDR_DESTPORT_1
+   TCP_HDR_DESTPORT_2 */
+	tcp_local_port = ip_rx2();
+	tcp_service = tcp_service_find(tcp_local_port);
+
+/* TCP_HDR_SEQNO_1
+   TCP_HDR_SEQNO_2 */
+	tcp_seq = ((uint32_t) ip_rx2()) << 16;
+
+/* TCP_HDR_SEQNO_3
+   TCP_HDR_SEQNO_4 */
+	tcp_seq = tcp_seq | ip_rx2();
+
+/* TCP_HDR_ACKNO_1
+   TCP_HDR_ACKNO_2 */
+	tcp_ack = ((uint32_t) ip_rx2()) << 16;
+
+/* TCP_HDR_ACKNO_3
+   TCP_HDR_ACKNO_4 */
+	tcp_ack = tcp_ack | ip_rx2();
+
+/* TCP_HDR_OFFSET */
+	data_offset = (ip_rx1() >> 4) * 4 + IP_HEADER_LENGTH;
+	tcp_data_length = ip_packet_length - data_offset;
+
+/* TCP_HDR_FLAGS */
+	tcp_flags = ip_rx1() & TCP_FLAGS;
+	
+/* TCP_HDR_WINDOW_1
+   TCP_HDR_WINDOW_2 */
+#if TCP_CONNECTIONS
+	tcp_remote_window = ip_rx2();
+	tcp_window = TCP_WINDOW;
+#else
+	ip_rx2();
+#endif
+
+/* TCP_HDR_CHKSUM_1
+   TCP_HDR_CHKSUM_2 */
+	ip_rx2();
+
+/* TCP_HDR_URGPTR_1
+   TCP_HDR_URGPTR_2 */
+	ip_rx2();
+
+	/* Header prediction (Van Jacobson): most segments acknowledge,
+	   perhaps bring a request, and have no options. They take the short way. */
+	predicted = data_offset == IP_HEADER_LENGTH + TCP_TX_HEADER_LENGTH &&
+	            (tcp_flags & ~TCP_FLAG_PSH) == TCP_FLAG_ACK;
+
+	if(!predicted)
+	{
+		/* Discard TCP options, but take note of the MSS of the client
+		   and of its Fast Open cookie. */
+#if TCP_CONNECTIONS
+		tcp_mss = TCP_DEFAULT_MSS;
+#endif
+		tcp_fastopen_request = 0;
+		tcp_fastopen_valid = 0;
+		while(byte_number < data_offset)
+		{
+			option = ip_rx1();
+			if(option == TCP_OPTION_END || option == TCP_OPTION_NOP ||
+			   byte_number == data_offset)
+			{
+				continue;
+			}
+
+			option_length = ip_rx1();
+			if(option == TCP_OPTION_MSS && option_length == TCP_OPTION_MSS_LENGTH &&
+			   byte_number + 2 <= data_offset)
+			{
+#if TCP_CONNECTIONS
+				tcp_mss = ip_rx2();
+#else
+				ip_rx2();
+#endif
+				continue;
+			}
+
+			if(option == TCP_OPTION_FASTOPEN)
+			{
+				/* Without a valid cookie, the SYN-ACK brings a new one. */
+				tcp_fastopen_request = 1;
+				if(option_length == TCP_OPTION_FASTOPEN_LENGTH &&
+				   byte_number + 4 <= data_offset)
+				{
+					cookie = ((uint32_t) ip_rx2()) << 16;
+					cookie = cookie | ip_rx2();
+					if(cookie == tcp_fastopen_cookie())
+					{
+						tcp_fastopen_request = 0;
+						tcp_fastopen_valid = 1;
+					}
+					continue;
+				}
+			}
+
+			for(; option_length > 2 && byte_number < data_offset; option_length--)
+			{
+				ip_rx1();
+			}
+		}
+	}
+
+	TIMING_STAGE(TIMING_HEADER);
+
+	/* Receive available data. The server may replace tcp_data_length
+	   with the length of its answer, so remember the length of the request. */
+	segment_length = tcp_data_length;
+	tcp_close = 0;
+	if(tcp_service == TCP_SERVICE_NONE)
+	{
+		/* Nobody listens; the data counts for the checksum only. */
+		while(byte_number < ip_packet_length)
+		{
+			ip_rx1();
+		}
+	}
+	else
+	{
+		while(byte_number < ip_packet_length)
+		{
+			tcp_server(RECEIVING, ip_rx1());
+		}
+	}
+
+	/* Check for correct TCP checksum. */
+ 	if(resulting_checksum() != 0xFFFF)
+ 	{
+		STATS_COUNT(STATS_TCP_CHECKSUM);
+ 		return;
+ 	}
+
+#if TCP_CONNECTIONS
+	if(predicted && tcp_connection_predicted(segment_length))
+	{
+		return;
+	}
+#endif
+
+	/* Never answer a reset. */
+	if(tcp_flags & TCP_FLAG_RST)
+	{
+#if TCP_CONNECTIONS
+		tcp_conn = tcp_connection_find();
+		if(tcp_conn != NULL)
+		{
+			tcp_conn->state = 0;
+		}
+#endif
+		return;
+	}
+
+	/* A FIN takes one number of the sequence space, like a byte of data. */
+	fin = tcp_flags & TCP_FLAG_FIN;
+
+	/* Process TCP request. */
+#if TCP_CONNECTIONS
+	if(tcp_service != TCP_SERVICE_NONE)
+	{
+		tcp_connection_rx(segment_length, fin);
+	}
+	else
+#else
+	if(tcp_service != TCP_SERVICE_NONE)
+	{
+		if(tcp_flags == TCP_FLAG_SYN)
+		{
+			tcp_syn_ack(segment_length);
+		}
+		else if(segment_length > 0 || fin)
+		{
+			if(tcp_cookie_valid())
+			{
+				/* First segment after the handshake. Answer the request
+				   and close our side at once, or just close our side
+				   if the client closes before asking anything.
+				   A Modbus connection carries one request too: only the
+				   cookie tells that the request is not forged, and only
+				   the first one after the handshake brings it. */
+#if HTTP_SERVER
+				if(tcp_service == TCP_SERVICE_HTTP && segment_length > 0)
+				{
+					http_accept();
+				}
+#endif
+#if MODBUS_SERVER
+				if(tcp_service == TCP_SERVICE_MODBUS && segment_length > 0)
+				{
+					modbus_execute();
+				}
+#endif
+				tcp_flags = TCP_FLAG_ACK | TCP_FLAG_FIN;
+				if(segment_length > 0)
+				{
+					tcp_flags |= TCP_FLAG_PSH;
+				}
+			}
+			else if(fin)
+			{
+				/* Our FIN went out together with the answer. */
+				tcp_flags = TCP_FLAG_ACK;
+				tcp_data_length = 0;
+			}
+			else
+			{
+				/* Stale or forged request. */
+				return;
+			}
+			SWAP(tcp_ack, tcp_seq);
+			tcp_ack += segment_length + fin;
+			tcp_tx();
+		}
+	}
+	else
+#endif
+	{
+		tcp_flags = TCP_FLAG_RST | TCP_FLAG_ACK;
+		SWAP(tcp_ack, tcp_seq);
+		tcp_ack++;
+		tcp_data_length = 0;
+		tcp_tx();
+	}
+}
+/*-----------------------------------------------------------------------------------*/
+/* Get the data at byte_number from the server; return how much of it
+   belongs to the segment. */
+uint16_t tcp_run_next(server_stage stage)
+{
+	tcp_run_summed = 0;
+	tcp_server(stage, '\0');
+
+	if(tcp_run_length > ip_packet_length - byte_number)
+	{
+		tcp_run_length = ip_packet_length - byte_number;
+	}
+
+	return tcp_run_length;
+}
+/*-----------------------------------------------------------------------------------*/
+void tcp_tx(void)
+{
+	uint16_t byte_number_backup;
+	uint16_t length;
+	uint16_t i;
+	uint32_t cookie;
+	uint8_t single_pass = 0;
+
+	if(tcp_flags & TCP_FLAG_RST)
+	{
+		STATS_COUNT(STATS_TCP_RESETS);
+	}
+
+	/* SYN advertises our MSS, and brings a Fast Open cookie if asked for. */
+	tcp_header_length = TCP_TX_HEADER_LENGTH;
+	if(tcp_flags & TCP_FLAG_SYN)
+	{
+		tcp_header_length += TCP_OPTION_MSS_LENGTH;
+		if(tcp_fastopen_request)
+		{
+			tcp_header_length += 2 + TCP_OPTION_FASTOPEN_LENGTH;
+			cookie = tcp_fastopen_cookie();
+		}
+	}
+
+	/* Adjust packet length. */
+	ip_packet_length = tcp_data_length + tcp_header_length;
+	
+	/* Transfer IP header. */
+	ip_tx();
+
+	/* Reinitialize TCP checksum. */
+	checksum = 0;
+
+ 	/* Add pseudo header. */
+ 	add_pseudo_header_to_checksum();
+
+ 	/* Transfer source port. */
+ 	ip_tx2(tcp_local_port);
+ 	
+ 	/* Transfer destination port. */
+ 	ip_tx2(tcp_remote_port);
+ 	
+ 	/* Transfer sequence number. */
+ 	ip_tx2(tcp_seq >> 16);
+ 	ip_tx2(tcp_seq & 0xFFFF);
+ 	
+ 	/* Transfer acknowledge number. */
+ 	ip_tx2(tcp_ack >> 16);
+ 	ip_tx2(tcp_ack & 0xFFFF);
+ 	
+ 	/* Transfer data offset. */
+ 	ip_tx1(tcp_header_length << 2);
+ 	
+ 	/* Transfer flags. */
+ 	ip_tx1(tcp_flags);
+ 	
+ 	/* Transfer window size. */
+ 	ip_tx2(tcp_window);
+
+ 	/* Calculate and transfer checksum. */
+ 	if(tcp_flags & TCP_FLAG_SYN)
+ 	{
+ 		checksum += TCP_OPTION_MSS << 8 | TCP_OPTION_MSS_LENGTH;
+ 		checksum += TCP_MSS;
+ 		if(tcp_fastopen_request)
+ 		{
+ 			checksum += TCP_OPTION_NOP << 8 | TCP_OPTION_NOP;
+ 			checksum += TCP_OPTION_FASTOPEN << 8 | TCP_OPTION_FASTOPEN_LENGTH;
+ 			checksum += cookie >> 16;
+ 			checksum += cookie & 0xFFFF;
+ 		}
+ 	}
+ 	if(ip_packet_length > IP_HEADER_LENGTH+tcp_header_length)	/* Only if there is a connection. */
+ 	{
+		TIMING_START();
+ 		single_pass = tcp_server(SNAPSHOT, '\0');
+ 	}
+ 	if(ip_packet_length > IP_HEADER_LENGTH+tcp_header_length && !single_pass)
+ 	{
+	 	byte_number_backup = byte_number;
+	 	/* Advance to TCP data and calculate checksum. */
+	 	byte_number = IP_HEADER_LENGTH + tcp_header_length;
+	 	while(byte_number < ip_packet_length)
+	 	{
+			length = tcp_run_next(CHECKSUM);
+			if(tcp_run_summed)
+			{
+				checksum += tcp_run_sum;
+				byte_number += length;
+				continue;
+			}
+			for(; length > 0; length--)
+			{
+				add_to_checksum(*tcp_run++);
+				byte_number++;
+			}
+ 		}
+ 		byte_number = byte_number_backup;
+	}
+#if TIMING
+ 	if(ip_packet_length > IP_HEADER_LENGTH+tcp_header_length)
+ 	{
+ 		timing_stage(TIMING_CHECKSUM);
+ 	}
+#endif
+ 	ip_tx2(~resulting_checksum());
+ 	
+ 	/* Transfer urgent pointer. We need it not. Make it zero. */
+ 	ip_tx2(0x0000);
+
+ 	/* Transfer options. */
+ 	if(tcp_flags & TCP_FLAG_SYN)
+ 	{
+ 		ip_tx1(TCP_OPTION_MSS);
+ 		ip_tx1(TCP_OPTION_MSS_LENGTH);
+ 		ip_tx2(TCP_MSS);
+ 		if(tcp_fastopen_request)
+ 		{
+ 			ip_tx1(TCP_OPTION_NOP);
+ 			ip_tx1(TCP_OPTION_NOP);
+ 			ip_tx1(TCP_OPTION_FASTOPEN);
+ 			ip_tx1(TCP_OPTION_FASTOPEN_LENGTH);
+ 			ip_tx2(cookie >> 16);
+ 			ip_tx2(cookie & 0xFFFF);
+ 		}
+ 	}
+
+ 	/* Transfer TCP data. A server which makes up for the checksum
+ 	   needs the sum of the data; otherwise it is summed up already. */
+ 	checksum = 0;
+ 	while(byte_number < ip_packet_length)
+	{
+		length = tcp_run_next(SENDING);
+		if(single_pass)
+		{
+			for(i = 0; i < length; i++, byte_number++)
+			{
+				add_to_checksum(tcp_run[i]);
+			}
+			byte_number -= length;
+		}
+		if(tcp_run_text)
+		{
+			slip_tx_frame(tcp_run, length);
+		}
+		else
+		{
+			for(i = 0; i < length; i++)
+			{
+				slip_tx(tcp_run[i]);
+			}
+		}
+		byte_number += length;
+	}
+
+ 	/* End packet (SLIP). */
+	end_packet();
+
+#if TIMING
+	if(ip_packet_length > IP_HEADER_LENGTH+tcp_header_length)
+	{
+		timing_stage(TIMING_SEND);
+	}
+#endif
+}
+#endif
+/*-----------------------------------------------------------------------------------*/
+
+#if HTTP_SERVER
+
+/* HTTP infrastructure. */
+
+
+const unsigned char http_status_ok[] = "HTTP/1.1 200 OK\r\n";
+
+#if !TCP_CONNECTIONS
+const unsigned char http_status_unavailable[] = "HTTP/1.1 503 Service Unavailable\r\n";
+#endif
+
+#if HTTP_RANGE
+const unsigned char http_status_partial[] = "HTTP/1.1 206 Partial Content\r\n";
+#endif
+
+const unsigned char http_content_type_html[] = "Content-type: text/html\r\n";
+
+#if STATS
+const unsigned char http_content_type_json[] = "Content-type: application/json\r\n";
+
+const unsigned char http_content_type_metrics[] = "Content-type: text/plain; version=0.0.4\r\n";
+#endif
+
+const unsigned char http_header[] = "Server: you would not know anyway\r\n";
+
+#if HTTP_RANGE
+const unsigned char http_content_range[] = "Content-Range: bytes ";
+const unsigned char http_range_dash[] = "-";
+const unsigned char http_range_slash[] = "/";
+#endif
+
+const unsigned char http_content_length[] = "Content-Length: ";
+
+const unsigned char http_header_end[] = "\r\n"
+                                        "\r\n";
+
+const unsigned char http_header_end_close[] = "\r\n"
+                                              "Connection: close\r\n"
+                                              "\r\n";
+
+/* Placeholders in page templates. A placeholder is the code of its
+   value; it is shown as wide as the value is. Pages have placeholders
+   only if they show values, or end with the checksum trailer. */
+#define HTTP_PLACEHOLDERS (HTTP_VALUES || HTTP_SINGLE_PASS)
+
+#define HTTP_VALUE_P0 0x80
+#define HTTP_VALUE_P1 0x81
+#define HTTP_VALUE_P2 0x82
+#define HTTP_VALUE_P3 0x83
+#define HTTP_VALUE_UPTIME 0x84
+#define HTTP_VALUE_REQUESTS 0x85
+#define HTTP_VALUE_CHECKSUM 0x86
+#define HTTP_VALUE_D0 0x87
+#define HTTP_VALUE_D1 0x88
+#define HTTP_VALUE_D2 0x89
+#define HTTP_VALUE_D3 0x8A
+
+#define HTTP_P0 "\x80"		/* Pins of the ports, hexadecimal. */
+#define HTTP_P1 "\x81"
+#define HTTP_P2 "\x82"
+#define HTTP_P3 "\x83"
+#define HTTP_UPTIME "\x84"	/* Seconds since reset. */
+#define HTTP_REQUESTS "\x85"	/* HTTP requests accepted. */
+#define HTTP_D0 "\x87"		/* Pins of the ports, decimal. */
+#define HTTP_D1 "\x88"
+#define HTTP_D2 "\x89"
+#define HTTP_D3 "\x8A"
+
+/* Machine cycles a stage boundary takes. */
+#define HTTP_VALUE_TIMING_OVERHEAD 0x8B
+
+/* Bytes of the stack used at most, and there are. */
+#define HTTP_VALUE_STACK_USED 0x8C
+#define HTTP_VALUE_STACK_SIZE 0x8D
+
+#define HTTP_STACK_USED "\x8C"
+#define HTTP_STACK_SIZE "\x8D"
+
+/* Statistics counters, one placeholder each from HTTP_VALUE_STATS on. */
+#define HTTP_VALUE_STATS 0x90
+
+#define HTTP_FRAMES "\x90"
+#define HTTP_IP_VHL "\x91"
+#define HTTP_IP_DESTINATION "\x92"
+#define HTTP_IP_CHECKSUM "\x93"
+#define HTTP_IP_PROTOCOL "\x94"
+#define HTTP_TCP_CHECKSUM "\x95"
+#define HTTP_TCP_RESETS "\x96"
+#define HTTP_ICMP_REPLIES "\x97"
+#define HTTP_UART_OVERRUNS "\x98"
+
+/* Stage histograms from HTTP_VALUE_TIMING on, eight codes per stage:
+   the buckets, counted up to their upper bound, then the sum. */
+#define HTTP_VALUE_TIMING 0xA0
+#define HTTP_TIMING_SUM 6
+
+#define HTTP_TIMING_OVERHEAD "\x8B"
+
+#define HTTP_TIMING_LINES(stage, b0, b1, b2, b3, b4, b5, sum) \
+	"pong_stage_cycles_bucket{stage=\"" stage "\",le=\"255\"} " b0 "\n" \
+	"pong_stage_cycles_bucket{stage=\"" stage "\",le=\"1023\"} " b1 "\n" \
+	"pong_stage_cycles_bucket{stage=\"" stage "\",le=\"4095\"} " b2 "\n" \
+	"pong_stage_cycles_bucket{stage=\"" stage "\",le=\"16383\"} " b3 "\n" \
+	"pong_stage_cycles_bucket{stage=\"" stage "\",le=\"65535\"} " b4 "\n" \
+	"pong_stage_cycles_bucket{stage=\"" stage "\",le=\"+Inf\"} " b5 "\n" \
+	"pong_stage_cycles_sum{stage=\"" stage "\"} " sum "\n" \
+	"pong_stage_cycles_count{stage=\"" stage "\"} " b5 "\n"
+
+/* A page ends with a comment whose characters make up for the checksum
+   of the data. Five of them add to the high bytes, five to the low bytes
+   of the checksum; each one adds 0 to HTTP_CHECKSUM_DIGIT_MAX above '@'. */
+#if HTTP_SINGLE_PASS
+#define HTTP_CHECKSUM "\x86"
+#define HTTP_CHECKSUM_SUFFIX "-->\r\n"
+#define HTTP_TRAILER "<!--" HTTP_CHECKSUM HTTP_CHECKSUM_SUFFIX
+#else
+#define HTTP_TRAILER ""
+#endif
+
+#define HTTP_CHECKSUM_WIDTH 10
+#define HTTP_CHECKSUM_DIGIT_MAX ('~' - '@')
+
+const unsigned char welcomepage[] = "<html>\r\n"
+                                    "<head>\r\n"
+                                    "<title>Welcome</title>\r\n"
+                                    "</head>\r\n"
+                                    "<body>\r\n"
+                                    "<h1>Welcome to the HTTPPONG server!</h1>\r\n"
+                                    "It seems to work indeed.\r\n"
+#if HTTP_TEMPLATE
+                                    "<pre>\r\n"
+                                    "Ports:    " HTTP_P0 " " HTTP_P1 " " HTTP_P2 " " HTTP_P3 "\r\n"
+                                    "Uptime:   " HTTP_UPTIME " s\r\n"
+                                    "Requests: " HTTP_REQUESTS "\r\n"
+                                    "</pre>\r\n"
+#endif
+                                    "</body>\r\n"
+                                    "</html>\r\n"
+                                    HTTP_TRAILER;
+
+/* Length of the template; the page as shown varies with the values. */
+#define WELCOMEPAGE_LENGTH (sizeof(welcomepage)-1)
+
+#if STATS
+/* Status for monitoring at /status.json, a JSON object of fixed schema.
+   It is short enough to be summed up as it is read, and has no trailer. */
+const unsigned char statuspage[] = "{\"ports\":[" HTTP_D0 "," HTTP_D1 "," HTTP_D2 "," HTTP_D3 "],"
+                                   "\"uptime\":" HTTP_UPTIME ","
+                                   "\"requests\":" HTTP_REQUESTS "}";
+
+/* Counters in the Prometheus text format at /metrics; no trailer either.
+   Gauges go without a TYPE line, as untyped samples are taken for gauges,
+   so that the page fits into one segment without a connection table. */
+const unsigned char metricspage[] = "# TYPE pong_frames_received_total counter\n"
+                                    "pong_frames_received_total " HTTP_FRAMES "\n"
+                                    "# TYPE pong_ip_dropped_total counter\n"
+                                    "pong_ip_dropped_total{reason=\"vhl\"} " HTTP_IP_VHL "\n"
+                                    "pong_ip_dropped_total{reason=\"destination\"} " HTTP_IP_DESTINATION "\n"
+                                    "pong_ip_dropped_total{reason=\"checksum\"} " HTTP_IP_CHECKSUM "\n"
+                                    "pong_ip_dropped_total{reason=\"protocol\"} " HTTP_IP_PROTOCOL "\n"
+                                    "# TYPE pong_tcp_checksum_errors_total counter\n"
+                                    "pong_tcp_checksum_errors_total " HTTP_TCP_CHECKSUM "\n"
+                                    "# TYPE pong_tcp_resets_sent_total counter\n"
+                                    "pong_tcp_resets_sent_total " HTTP_TCP_RESETS "\n"
+                                    "# TYPE pong_icmp_replies_total counter\n"
+                                    "pong_icmp_replies_total " HTTP_ICMP_REPLIES "\n"
+                                    "# TYPE pong_uart_overruns_total counter\n"
+                                    "pong_uart_overruns_total " HTTP_UART_OVERRUNS "\n"
+                                    "# TYPE pong_http_requests_total counter\n"
+                                    "pong_http_requests_total " HTTP_REQUESTS "\n"
+                                    "pong_uptime_seconds " HTTP_UPTIME "\n"
+                                    "pong_stack_used_bytes " HTTP_STACK_USED "\n"
+                                    "pong_stack_size_bytes " HTTP_STACK_SIZE "\n"
+#if TIMING
+                                    "# TYPE pong_stage_cycles histogram\n"
+                                    HTTP_TIMING_LINES("wait", "\xA0", "\xA1", "\xA2", "\xA3", "\xA4", "\xA5", "\xA6")
+                                    HTTP_TIMING_LINES("header", "\xA8", "\xA9", "\xAA", "\xAB", "\xAC", "\xAD", "\xAE")
+                                    HTTP_TIMING_LINES("checksum", "\xB0", "\xB1", "\xB2", "\xB3", "\xB4", "\xB5", "\xB6")
+                                    HTTP_TIMING_LINES("send", "\xB8", "\xB9", "\xBA", "\xBB", "\xBC", "\xBD", "\xBE")
+                                    "pong_timing_overhead_cycles " HTTP_TIMING_OVERHEAD "\n"
+#endif
+                                    ;
+
+#define METRICSPAGE_LENGTH (sizeof(metricspage)-1)
+
+#if !TCP_CONNECTIONS
+/* Longest answer at /metrics: every counter and the requests at five
+   digits, the uptime at ten and the bytes of stack at three, each in
+   place of its placeholder, and a Content-Length of four digits. */
+#define METRICSPAGE_LENGTH_MAX (METRICSPAGE_LENGTH + (STATS_COUNTERS+1)*(5-1) + (10-1) + 2*(3-1))
+#define METRICS_ANSWER_LENGTH_MAX (sizeof(http_status_ok)-1 + sizeof(http_content_type_metrics)-1 + \
+                                   sizeof(http_header)-1 + sizeof(http_content_length)-1 + 4 + \
+                                   sizeof(http_header_end_close)-1 + METRICSPAGE_LENGTH_MAX)
+
+/* Without a connection table the answer has to fit into one segment;
+   this does not compile if it may not. */
+typedef char metrics_answer_fits[(METRICS_ANSWER_LENGTH_MAX <= TCP_MSS) ? 1 : -1];
+#endif
+#endif
+
+/* Index of a page for the checksum: the sum of its text before every
+   HTTP_SUM_STRIDE characters, so that a segment anywhere in the page
+   takes two lookups and a short scan. It is kept in XRAM, so only with
+   the connection table; without it an answer goes out in one segment
+   and is summed up as it is read. */
+#define HTTP_SUM_STRIDE 64
+
+#if TCP_CONNECTIONS
+#define WELCOMEPAGE_SUMS (WELCOMEPAGE_LENGTH/HTTP_SUM_STRIDE + 1)
+__xdata uint16_t welcomepage_sums[WELCOMEPAGE_SUMS];
+#if STATS
+#define METRICSPAGE_SUMS (METRICSPAGE_LENGTH/HTTP_SUM_STRIDE + 1)
+__xdata uint16_t metricspage_sums[METRICSPAGE_SUMS];
+#endif
+#else
+#define welcomepage_sums ((__xdata uint16_t *) 0)
+#define metricspage_sums ((__xdata uint16_t *) 0)
+#endif
+
+/* Notes on an answer, one per request. */
+#define HTTP_ANSWER_CLOSE 0x01	/* Answer ends with closing the connection. */
+#define HTTP_ANSWER_RANGE 0x02	/* Answer is a range of the page. */
+#define HTTP_ANSWER_PAGE 0x0C	/* Page of the answer; the welcome page is 0. */
+#define HTTP_ANSWER_STATUS 0x04
+#define HTTP_ANSWER_METRICS 0x08
+#define HTTP_ANSWER_UNAVAILABLE 0x0C	/* No page: the answers do not fit into a segment. */
+
+/* tcp_notes[0] is the number of answers, then follows the note of every answer.
+   Next come first and last byte of the range; of pipelined requests only
+   one is answered with a range, the others get the whole page. Last come
+   the values the page shows, latched with the first of the requests,
+   so that every segment of the answers shows the same. */
+#define HTTP_ANSWERS tcp_notes[0]
+#define HTTP_NOTE_FIRST (HTTP_PIPELINE+1)
+#define HTTP_NOTE_LAST (HTTP_NOTE_FIRST+2)
+#if HTTP_RANGE
+#define HTTP_NOTE_PORTS (HTTP_NOTE_LAST+2)
+#else
+#define HTTP_NOTE_PORTS HTTP_NOTE_FIRST
+#endif
+#define HTTP_NOTE_UPTIME (HTTP_NOTE_PORTS+4)
+#define HTTP_NOTE_REQUESTS (HTTP_NOTE_UPTIME+4)
+#if HTTP_VALUES
+#define HTTP_NOTE_STATS (HTTP_NOTE_REQUESTS+2)
+#else
+#define HTTP_NOTE_STATS HTTP_NOTE_PORTS
+#endif
+#define HTTP_NOTE_STACK (HTTP_NOTE_STATS+STATS_COUNTERS*2)
+
+#if HTTP_NOTE_STATS+STATS_NOTES != HTTP_NOTES
+#error HTTP_NOTES does not match the notes of the HTTP server
+#endif
+
+/* Parts of an answer: text from ROM, a decimal number, or a slice of a page. */
+#define HTTP_PART_TEXT 0
+#define HTTP_PART_DECIMAL 1
+#define HTTP_PART_PAGE 2
+
+uint8_t http_part_kind;
+const unsigned char *http_part_text;	/* Text, or the page. */
+__xdata uint16_t *http_part_sums;		/* Index of the page. */
+uint16_t http_part_value;				/* Number, or first byte of the slice. */
+uint16_t http_part_length;
+
+const unsigned char http_connection[] = "connection:";
+
+#if STATS
+/* Paths of the pages besides the welcome page, after http_path_prefix.
+   They differ in their first character. */
+const unsigned char http_path_prefix[] = "GET /";
+const unsigned char http_status_path[] = "status.json";
+const unsigned char http_metrics_path[] = "metrics";
+
+const unsigned char * const http_paths[] =
+{
+	http_status_path,
+	http_metrics_path,
+};
+
+const uint8_t http_path_pages[] =
+{
+	HTTP_ANSWER_STATUS,
+	HTTP_ANSWER_METRICS,
+};
+
+#define HTTP_PATHS sizeof(http_path_pages)
+#endif
+
+/* Request parser. */
+uint8_t http_line_length;
+uint8_t http_matched;		/* Characters of http_connection, or of the path, matched on this line. */
+#if STATS
+uint8_t http_path;			/* Path being matched. */
+#endif
+uint8_t http_page;			/* Page requested. */
+unsigned char http_last;	/* Previous character. */
+bit http_request_line;
+bit http_close;
+
+#if HTTP_RANGE
+/* Range header parser: "Range: bytes=first-last", "first-" or "-suffix". */
+#define HTTP_RANGE_NAME 0		/* Matching the name. */
+#define HTTP_RANGE_UNIT 1		/* Matching the unit. */
+#define HTTP_RANGE_FIRST 2
+#define HTTP_RANGE_LAST 3
+#define HTTP_RANGE_NONE 4		/* No range we can serve on this line. */
+
+#define HTTP_RANGE_GIVEN_FIRST 0x01
+#define HTTP_RANGE_GIVEN_LAST 0x02
+
+const unsigned char http_range_name[] = "range:";
+const unsigned char http_range_unit[] = "bytes=";
+
+uint8_t http_range_state;
+uint8_t http_range_matched;
+uint8_t http_range_given;
+uint16_t http_range_values[2];	/* First and last byte as received. */
+bit http_range;					/* The request has a range. */
+#endif
+
+#if HTTP_VALUES
+/* HTTP requests accepted since reset. */
+uint16_t http_requests;
+#endif
+
+#if HTTP_PLACEHOLDERS
+/* Length of the pages as shown with the values noted. */
+uint16_t http_welcomepage_length;
+#if STATS
+uint16_t http_statuspage_length;
+uint16_t http_metricspage_length;
+#endif
+
+/* Where in a page the body was found last; it is mostly read on from there. */
+const unsigned char *http_cursor_page;
+uint16_t http_cursor_index;		/* Index in the page. */
+uint16_t http_cursor_body;		/* Index in the body. */
+uint8_t http_position;			/* Position within the value found. */
+#else
+#define http_welcomepage_length WELCOMEPAGE_LENGTH
+#endif
+
+#if HTTP_SINGLE_PASS
+/* Index of the checksum placeholder in the segment being sent,
+   if the segment is sent in a single pass. */
+#define HTTP_NO_TRAILER 0xFFFF
+uint16_t http_trailer;
+
+/* What the placeholder adds to the checksum. */
+uint16_t http_compensation;
+#endif
+
+const uint32_t http_powers_of_ten[] = {1, 10, 100, 1000, 10000, 100000, 1000000,
+                                       10000000, 100000000, 1000000000};
+
+#if HTTP_VALUES
+const unsigned char http_hex_digits[] = "0123456789ABCDEF";
+#endif
+/*-----------------------------------------------------------------------------------*/
+/* Return the character at the position of the decimal number. */
+unsigned char http_decimal(uint32_t value, uint8_t width, uint8_t position)
+{
+	return '0' + (value / http_powers_of_ten[width - 1 - position]) % 10;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Return the number of digits of the decimal number. */
+uint8_t http_decimal_width(uint32_t value)
+{
+	uint8_t width = 1;
+
+	while(width < sizeof(http_powers_of_ten)/sizeof(http_powers_of_ten[0]) &&
+	      value >= http_powers_of_ten[width])
+	{
+		width++;
+	}
+
+	return width;
+}
+/*-----------------------------------------------------------------------------------*/
+#if HTTP_VALUES
+/* Return the character at the position of the hexadecimal byte. */
+unsigned char http_hex(uint8_t value, uint8_t position)
+{
+	return http_hex_digits[position ? value & 0x0F : value >> 4];
+}
+#endif
+/*-----------------------------------------------------------------------------------*/
+#if HTTP_VALUES || HTTP_RANGE
+/* Return the number noted at the index. */
+uint32_t http_note(uint8_t index, uint8_t length)
+{
+	uint32_t value = 0;
+
+	for(; length > 0; length--, index++)
+	{
+		value = value << 8 | tcp_notes[index];
+	}
+
+	return value;
+}
+/*-----------------------------------------------------------------------------------*/
+void http_note_set(uint8_t index, uint8_t length, uint32_t value)
+{
+	for(index += length; length > 0; length--)
+	{
+		tcp_notes[--index] = value & 0xFF;
+		value >>= 8;
+	}
+}
+#endif
+/*-----------------------------------------------------------------------------------*/
+#if TIMING
+/* Return the value of a stage histogram, as latched. */
+uint32_t http_timing_value(unsigned char code)
+{
+	__xdata timing_histogram *histogram = &timing_latched[(code - HTTP_VALUE_TIMING) >> 3];
+	uint8_t bucket = code & 0x07;
+	uint16_t count = 0;
+	uint8_t i;
+
+	if(code == HTTP_VALUE_TIMING_OVERHEAD)
+	{
+		return timing_overhead;
+	}
+
+	if(bucket == HTTP_TIMING_SUM)
+	{
+		return histogram->sum;
+	}
+
+	for(i = 0; i <= bucket; i++)
+	{
+		count += histogram->counts[i];
+	}
+
+	return count;
+}
+#endif
+/*-----------------------------------------------------------------------------------*/
+#if HTTP_PLACEHOLDERS
+/* Return the width of the value shown for a placeholder. */
+uint8_t http_value_width(unsigned char code)
+{
+#if TIMING
+	if(code >= HTTP_VALUE_TIMING || code == HTTP_VALUE_TIMING_OVERHEAD)
+	{
+		return http_decimal_width(http_timing_value(code));
+	}
+#endif
+
+#if STATS
+	if(code >= HTTP_VALUE_STATS)
+	{
+		return http_decimal_width(http_note(HTTP_NOTE_STATS + 2*(code - HTTP_VALUE_STATS), 2));
+	}
+
+	switch(code)
+	{
+		case HTTP_VALUE_STACK_USED:
+			return http_decimal_width(tcp_notes[HTTP_NOTE_STACK]);
+		case HTTP_VALUE_STACK_SIZE:
+			return http_decimal_width(IRAM_SIZE-1 - stats_stack_bottom);
+	}
+#endif
+
+#if HTTP_VALUES
+	switch(code)
+	{
+		case HTTP_VALUE_UPTIME:
+			return http_decimal_width(http_note(HTTP_NOTE_UPTIME, 4));
+		case HTTP_VALUE_REQUESTS:
+			return http_decimal_width(http_note(HTTP_NOTE_REQUESTS, 2));
+		case HTTP_VALUE_D0:
+		case HTTP_VALUE_D1:
+		case HTTP_VALUE_D2:
+		case HTTP_VALUE_D3:
+			return http_decimal_width(tcp_notes[HTTP_NOTE_PORTS + code - HTTP_VALUE_D0]);
+		case HTTP_VALUE_P0:
+		case HTTP_VALUE_P1:
+		case HTTP_VALUE_P2:
+		case HTTP_VALUE_P3:
+			/* Pins of a port. */
+			return 2;
+	}
+#endif
+
+	return HTTP_CHECKSUM_WIDTH;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Render the character at the position of a placeholder. */
+unsigned char http_value(unsigned char code, uint8_t position, uint8_t width)
+{
+#if TIMING
+	if(code >= HTTP_VALUE_TIMING || code == HTTP_VALUE_TIMING_OVERHEAD)
+	{
+		return http_decimal(http_timing_value(code), width, position);
+	}
+#endif
+
+#if STATS
+	if(code >= HTTP_VALUE_STATS)
+	{
+		return http_decimal(http_note(HTTP_NOTE_STATS + 2*(code - HTTP_VALUE_STATS), 2), width, position);
+	}
+
+	switch(code)
+	{
+		case HTTP_VALUE_STACK_USED:
+			return http_decimal(tcp_notes[HTTP_NOTE_STACK], width, position);
+		case HTTP_VALUE_STACK_SIZE:
+			return http_decimal(IRAM_SIZE-1 - stats_stack_bottom, width, position);
+	}
+#endif
+
+#if HTTP_VALUES
+	switch(code)
+	{
+		case HTTP_VALUE_P0:
+		case HTTP_VALUE_P1:
+		case HTTP_VALUE_P2:
+		case HTTP_VALUE_P3:
+			return http_hex(tcp_notes[HTTP_NOTE_PORTS + code - HTTP_VALUE_P0], position);
+		case HTTP_VALUE_UPTIME:
+			return http_decimal(http_note(HTTP_NOTE_UPTIME, 4), width, position);
+		case HTTP_VALUE_REQUESTS:
+			return http_decimal(http_note(HTTP_NOTE_REQUESTS, 2), width, position);
+		case HTTP_VALUE_D0:
+		case HTTP_VALUE_D1:
+		case HTTP_VALUE_D2:
+		case HTTP_VALUE_D3:
+			return http_decimal(tcp_notes[HTTP_NOTE_PORTS + code - HTTP_VALUE_D0], width, position);
+	}
+#endif
+
+	return '?';
+}
+/*-----------------------------------------------------------------------------------*/
+/* Return the length of the page as shown with the values noted. */
+uint16_t http_page_length(const unsigned char *page)
+{
+	uint16_t length = 0;
+
+	for(; *page != '\0'; page++)
+	{
+		length += (*page < 0x80) ? 1 : http_value_width(*page);
+	}
+
+	return length;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Measure the pages as shown with the values noted. */
+void http_values_measure(void)
+{
+	http_welcomepage_length = http_page_length(welcomepage);
+#if STATS
+	http_statuspage_length = http_page_length(statuspage);
+	http_metricspage_length = http_page_length(metricspage);
+#endif
+	http_cursor_page = 0;
+}
+#endif
+/*-----------------------------------------------------------------------------------*/
+#if HTTP_VALUES
+/* Note the values the page shows. */
+void http_values_latch(void)
+{
+#if STATS
+	uint8_t i;
+
+	/* The UART counts its overruns. */
+	ES = 0;
+	for(i = 0; i < STATS_COUNTERS; i++)
+	{
+		http_note_set(HTTP_NOTE_STATS + 2*i, 2, stats[i]);
+	}
+	ES = 1;
+	tcp_notes[HTTP_NOTE_STACK] = stats_stack_probe();
+#endif
+
+	tcp_notes[HTTP_NOTE_PORTS] = P0;
+	tcp_notes[HTTP_NOTE_PORTS+1] = P1;
+	tcp_notes[HTTP_NOTE_PORTS+2] = P2;
+	tcp_notes[HTTP_NOTE_PORTS+3] = P3;
+	http_note_set(HTTP_NOTE_UPTIME, 4, timer_uptime());
+	http_note_set(HTTP_NOTE_REQUESTS, 2, http_requests);
+	http_values_measure();
+}
+#endif
+/*-----------------------------------------------------------------------------------*/
+#if TIMING
+/* Latch the stage histograms for an answer, unless the answer of
+   a connection still shows the ones latched before. Answers of one
+   batch, and the segments sent again, show the same. */
+void http_timing_latch(void)
+{
+	__xdata tcp_connection *conn;
+	uint8_t i;
+	uint8_t j;
+
+	for(conn = tcp_connections; conn < tcp_connections + TCP_CONNECTIONS; conn++)
+	{
+		if(conn->state == 0 || conn->local_port != HTTP_PORT || conn->offset >= conn->length)
+		{
+			continue;
+		}
+
+		for(i = 1; i <= conn->notes[0]; i++)
+		{
+			if((conn->notes[i] & HTTP_ANSWER_PAGE) == HTTP_ANSWER_METRICS)
+			{
+				return;
+			}
+		}
+	}
+
+	for(i = 0; i < TIMING_STAGES; i++)
+	{
+		for(j = 0; j < TIMING_BUCKETS; j++)
+		{
+			timing_latched[i].counts[j] = timing_histograms[i].counts[j];
+		}
+		timing_latched[i].sum = timing_histograms[i].sum;
+	}
+}
+#endif
+/*-----------------------------------------------------------------------------------*/
+#if HTTP_PLACEHOLDERS
+/* Return the index in the page of the character shown at the index of
+   the body, and set http_position to the position within its value. */
+uint16_t http_page_index(const unsigned char *page, uint16_t body_index)
+{
+	uint16_t char_index = 0;
+	uint16_t body = 0;
+	uint8_t width;
+
+	/* Go on from where the last character was found, if not beyond. */
+	if(page == http_cursor_page && body_index >= http_cursor_body)
+	{
+		char_index = http_cursor_index;
+		body = http_cursor_body;
+	}
+
+	for(;; char_index++)
+	{
+		width = (page[char_index] < 0x80) ? 1 : http_value_width(page[char_index]);
+		if(body_index < body + width)
+		{
+			break;
+		}
+		body += width;
+	}
+
+	http_cursor_page = page;
+	http_cursor_index = char_index;
+	http_cursor_body = body;
+	http_position = body_index - body;
+
+	return char_index;
+}
+#endif
+/*-----------------------------------------------------------------------------------*/
+#if HTTP_SINGLE_PASS
+/* Render the character at the position of the checksum placeholder.
+   Only the placeholder a single pass segment ends with makes up for
+   the checksum; any other one shows just '@'. */
+unsigned char http_checksum(const unsigned char *placeholder, uint8_t position, uint16_t number)
+{
+	uint8_t value;
+
+	if(number - (IP_HEADER_LENGTH + tcp_header_length) - position != http_trailer)
+	{
+		return '@';
+	}
+
+	if(position == 0)
+	{
+		/* Add what follows the placeholder and what every character
+		   of it adds at least; the placeholder adds the rest. */
+		value = number & 0x1;
+		for(placeholder++; *placeholder != '\0'; placeholder++, value ^= 0x1)
+		{
+			checksum += value ? *placeholder : ((uint16_t) *placeholder) << 8;
+		}
+		checksum += (uint32_t) (HTTP_CHECKSUM_WIDTH/2) * 0x4040UL; /* '@' << 8 | '@', in 32 bits */
+		http_compensation = ~resulting_checksum();
+	}
+
+	/* Characters at even byte numbers add to the high byte. */
+	value = (number & 0x1) ? http_compensation & 0xFF : http_compensation >> 8;
+	position = (position >> 1) * HTTP_CHECKSUM_DIGIT_MAX;
+	if(value <= position)
+	{
+		return '@';
+	}
+	value -= position;
+
+	return '@' + (value < HTTP_CHECKSUM_DIGIT_MAX ? value : HTTP_CHECKSUM_DIGIT_MAX);
+}
+#endif
+/*-----------------------------------------------------------------------------------*/
+
+#if TCP_CONNECTIONS
+/* Sum up the text of a page from the index on, placeholders left out;
+   characters at even indexes add to the high byte. */
+uint32_t http_sum(const unsigned char *page, uint16_t char_index, uint16_t end, uint32_t sum)
+{
+	for(; char_index < end; char_index++)
+	{
+		if(page[char_index] < 0x80)
+		{
+			sum += (char_index & 0x1) ? page[char_index] : ((uint16_t) page[char_index]) << 8;
+		}
+	}
+
+	while(sum & 0xFFFF0000)
+	{
+		sum = (sum & 0xFFFF) + (sum >> 16);
+	}
+
+	return sum;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Index the page for the checksum. */
+void http_index(const unsigned char *page, uint16_t length, __xdata uint16_t *sums)
+{
+	uint16_t i;
+
+	sums[0] = 0;
+	for(i = HTTP_SUM_STRIDE; i <= length; i += HTTP_SUM_STRIDE)
+	{
+		sums[i / HTTP_SUM_STRIDE] = http_sum(page, i - HTTP_SUM_STRIDE, i, sums[i / HTTP_SUM_STRIDE - 1]);
+	}
+}
+/*-----------------------------------------------------------------------------------*/
+/* Return the sum of the text of a page before the index. */
+uint16_t http_prefix_sum(const unsigned char *page, __xdata uint16_t *sums, uint16_t char_index)
+{
+	uint16_t start = char_index & ~(HTTP_SUM_STRIDE-1);
+
+	return http_sum(page, start, char_index, sums[start / HTTP_SUM_STRIDE]);
+}
+#endif
+/*-----------------------------------------------------------------------------------*/
+/* Hand out the data at the index of the body of a page: the text up to
+   the next placeholder, or a chunk of the value rendered. At CHECKSUM
+   the text is summed up from the index of the page. Nothing is handed
+   out from the end of the body on. */
+void http_template(server_stage stage, const unsigned char *page, __xdata uint16_t *sums,
+                   uint16_t body_index, uint16_t end)
+{
+#if HTTP_PLACEHOLDERS
+	uint16_t char_index = http_page_index(page, body_index);
+	unsigned char c = page[char_index];
+	uint8_t position = http_position;
+	uint8_t width;
+	uint8_t i;
+#else
+	uint16_t char_index = body_index;
+	unsigned char c = page[char_index];
+#endif
+#if TCP_CONNECTIONS
+	uint32_t sum;
+#endif
+
+	tcp_run = page + char_index;
+	if(c < 0x80)
+	{
+		for(tcp_run_length = 1; body_index + tcp_run_length < end && tcp_run[tcp_run_length] < 0x80; tcp_run_length++)
+		{
+		}
+
+#if TCP_CONNECTIONS
+		if(stage == CHECKSUM && sums)
+		{
+			if(tcp_run_length > ip_packet_length - byte_number)
+			{
+				tcp_run_length = ip_packet_length - byte_number;
+			}
+
+			/* Difference of the sums before the end and before the start. */
+			sum = http_prefix_sum(page, sums, char_index + tcp_run_length);
+			sum += (uint16_t) ~http_prefix_sum(page, sums, char_index);
+			sum = (sum & 0xFFFF) + (sum >> 16);
+
+			/* Swap the bytes if the page and the segment differ in parity. */
+			if((byte_number ^ char_index) & 0x1)
+			{
+				sum = (sum >> 8 | sum << 8) & 0xFFFF;
+			}
+
+			tcp_run_sum = sum;
+			tcp_run_summed = 1;
+		}
+#endif
+		return;
+	}
+
+#if HTTP_PLACEHOLDERS
+	width = http_value_width(c);
+	for(i = 0; i < TCP_CHUNK_LENGTH && position < width && body_index + i < end; i++, position++)
+	{
+#if HTTP_SINGLE_PASS
+		if(c == HTTP_VALUE_CHECKSUM)
+		{
+			tcp_chunk[i] = http_checksum(tcp_run, position, byte_number + i);
+			continue;
+		}
+#endif
+		tcp_chunk[i] = http_value(c, position, width);
+	}
+
+	tcp_run = tcp_chunk;
+	tcp_run_length = i;
+#endif
+}
+/*-----------------------------------------------------------------------------------*/
+void http_part_string(const unsigned char *text, uint16_t length)
+{
+	http_part_kind = HTTP_PART_TEXT;
+	http_part_text = text;
+	http_part_length = length;
+}
+/*-----------------------------------------------------------------------------------*/
+void http_part_decimal(uint16_t value)
+{
+	http_part_kind = HTTP_PART_DECIMAL;
+	http_part_value = value;
+	http_part_length = http_decimal_width(value);
+}
+/*-----------------------------------------------------------------------------------*/
+/* Select the page of the answer as the text of its parts;
+   return its length as shown. */
+uint16_t http_page_select(uint8_t note)
+{
+	switch(note & HTTP_ANSWER_PAGE)
+	{
+#if STATS
+		case HTTP_ANSWER_STATUS:
+			http_part_text = statuspage;
+			http_part_sums = 0;
+			return http_statuspage_length;
+		case HTTP_ANSWER_METRICS:
+			http_part_text = metricspage;
+			http_part_sums = metricspage_sums;
+			return http_metricspage_length;
+#endif
+#if !TCP_CONNECTIONS
+		case HTTP_ANSWER_UNAVAILABLE:
+			http_part_sums = 0;
+			return 0;
+#endif
+	}
+
+	http_part_text = welcomepage;
+	http_part_sums = welcomepage_sums;
+	return http_welcomepage_length;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Describe the part of the answer; return 0 past the last part. */
+uint8_t http_part(uint8_t note, uint8_t part)
+{
+	uint16_t first = 0;
+	uint16_t last = http_page_select(note)-1;
+
+#if HTTP_RANGE
+	if(note & HTTP_ANSWER_RANGE)
+	{
+		first = http_note(HTTP_NOTE_FIRST, 2);
+		last = http_note(HTTP_NOTE_LAST, 2);
+	}
+	else
+#endif
+	if(part >= 3 && part <= 9)
+	{
+		/* No Content-Range header. */
+		http_part_string(http_header, 0);
+		return 1;
+	}
+
+	switch(part)
+	{
+		case 0:
+#if HTTP_RANGE
+			if(note & HTTP_ANSWER_RANGE)
+			{
+				http_part_string(http_status_partial, sizeof(http_status_partial)-1);
+				break;
+			}
+#endif
+#if !TCP_CONNECTIONS
+			if((note & HTTP_ANSWER_PAGE) == HTTP_ANSWER_UNAVAILABLE)
+			{
+				http_part_string(http_status_unavailable, sizeof(http_status_unavailable)-1);
+				break;
+			}
+#endif
+			http_part_string(http_status_ok, sizeof(http_status_ok)-1);
+			break;
+		case 1:
+			switch(note & HTTP_ANSWER_PAGE)
+			{
+#if STATS
+				case HTTP_ANSWER_STATUS:
+					http_part_string(http_content_type_json, sizeof(http_content_type_json)-1);
+					break;
+				case HTTP_ANSWER_METRICS:
+					http_part_string(http_content_type_metrics, sizeof(http_content_type_metrics)-1);
+					break;
+#endif
+#if !TCP_CONNECTIONS
+				case HTTP_ANSWER_UNAVAILABLE:
+					http_part_string(http_header, 0);
+					break;
+#endif
+				default:
+					http_part_string(http_content_type_html, sizeof(http_content_type_html)-1);
+					break;
+			}
+			break;
+		case 2:
+			http_part_string(http_header, sizeof(http_header)-1);
+			break;
+#if HTTP_RANGE
+		case 3:
+			http_part_string(http_content_range, sizeof(http_content_range)-1);
+			break;
+		case 4:
+			http_part_decimal(first);
+			break;
+		case 5:
+			http_part_string(http_range_dash, sizeof(http_range_dash)-1);
+			break;
+		case 6:
+			http_part_decimal(last);
+			break;
+		case 7:
+			http_part_string(http_range_slash, sizeof(http_range_slash)-1);
+			break;
+		case 8:
+			http_part_decimal(http_welcomepage_length);
+			break;
+		case 9:
+			http_part_string(http_header_end, 2);
+			break;
+#endif
+		case 10:
+			http_part_string(http_content_length, sizeof(http_content_length)-1);
+			break;
+		case 11:
+			http_part_decimal(last - first + 1);
+			break;
+		case 12:
+			if(note & HTTP_ANSWER_CLOSE)
+			{
+				http_part_string(http_header_end_close, sizeof(http_header_end_close)-1);
+			}
+			else
+			{
+				http_part_string(http_header_end, sizeof(http_header_end)-1);
+			}
+			break;
+		case 13:
+			/* The page is selected already. */
+			http_part_kind = HTTP_PART_PAGE;
+			http_part_value = first;
+			http_part_length = last - first + 1;
+			break;
+		default:
+			return 0;
+	}
+
+	return 1;
+}
+/*-----------------------------------------------------------------------------------*/
+uint16_t http_answer_length(uint8_t note)
+{
+	uint16_t length = 0;
+	uint8_t part;
+
+	for(part = 0; http_part(note, part); part++)
+	{
+		length += http_part_length;
+	}
+
+	return length;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Hand out the data at the index of the answer. */
+void http_answer(server_stage stage, uint8_t note, uint16_t char_index)
+{
+	uint8_t part;
+	uint8_t i;
+
+	for(part = 0; http_part(note, part); part++)
+	{
+		if(char_index < http_part_length)
+		{
+			break;
+		}
+		char_index -= http_part_length;
+	}
+
+	switch(http_part_kind)
+	{
+		case HTTP_PART_TEXT:
+			tcp_run = http_part_text + char_index;
+			tcp_run_length = http_part_length - char_index;
+			break;
+
+		case HTTP_PART_DECIMAL:
+			for(i = 0; i < TCP_CHUNK_LENGTH && char_index < http_part_length; i++, char_index++)
+			{
+				tcp_chunk[i] = http_decimal(http_part_value, http_part_length, char_index);
+			}
+			tcp_run = tcp_chunk;
+			tcp_run_length = i;
+			break;
+
+		case HTTP_PART_PAGE:
+			http_template(stage, http_part_text, http_part_sums, http_part_value + char_index,
+			              http_part_value + http_part_length);
+			break;
+	}
+}
+/*-----------------------------------------------------------------------------------*/
+#if HTTP_SINGLE_PASS
+/* Check whether the segment ends with an answer, and with all of the
+   checksum placeholder of that answer. If so, note where it starts. */
+uint8_t http_single_pass(void)
+{
+	uint16_t end = tcp_data_offset + tcp_data_length;
+	uint16_t answers_end = 0;
+	uint8_t i;
+
+	http_trailer = HTTP_NO_TRAILER;
+
+	for(i = 1; i <= HTTP_ANSWERS && answers_end < end; i++)
+	{
+		answers_end += http_answer_length(tcp_notes[i]);
+	}
+
+	/* Only the welcome page has a trailer. */
+	if(answers_end != end || (tcp_notes[i-1] & HTTP_ANSWER_PAGE) ||
+	   tcp_data_length < HTTP_CHECKSUM_WIDTH + sizeof(HTTP_CHECKSUM_SUFFIX)-1)
+	{
+		return 0;
+	}
+
+	http_trailer = tcp_data_length - HTTP_CHECKSUM_WIDTH - (sizeof(HTTP_CHECKSUM_SUFFIX)-1);
+	return 1;
+}
+#endif
+/*-----------------------------------------------------------------------------------*/
+#if STATS
+/* Match the path on the request line, one character at a time,
+   up to a query or the version. */
+void http_path_rx(unsigned char c)
+{
+	const unsigned char *path;
+
+	/* Nothing to match after a mismatch, or after the path. */
+	if(http_matched != http_line_length-1)
+	{
+		return;
+	}
+
+	if(http_matched < sizeof(http_path_prefix)-1)
+	{
+		if(c == http_path_prefix[http_matched])
+		{
+			http_matched++;
+		}
+		return;
+	}
+
+	/* The first character tells the path. */
+	if(http_matched == sizeof(http_path_prefix)-1)
+	{
+		for(http_path = 0; http_path < HTTP_PATHS && http_paths[http_path][0] != c; http_path++)
+		{
+		}
+	}
+
+	if(http_path == HTTP_PATHS)
+	{
+		return;
+	}
+
+	path = http_paths[http_path] + http_matched - (sizeof(http_path_prefix)-1);
+	if(*path == c)
+	{
+		http_matched++;
+	}
+	else if(*path == '\0' && (c == ' ' || c == '?'))
+	{
+		http_page = http_path_pages[http_path];
+	}
+}
+#endif
+/*-----------------------------------------------------------------------------------*/
+#if HTTP_RANGE
+/* Parse the Range header, one character of a header line at a time. */
+void http_range_rx(unsigned char c)
+{
+	uint8_t i;
+
+	switch(http_range_state)
+	{
+		case HTTP_RANGE_NAME:
+			if(http_range_matched == http_line_length-1 &&
+			   (c | 0x20) == http_range_name[http_range_matched])
+			{
+				http_range_matched++;
+				if(http_range_matched == sizeof(http_range_name)-1)
+				{
+					http_range_state = HTTP_RANGE_UNIT;
+					http_range_matched = 0;
+				}
+			}
+			else
+			{
+				http_range_state = HTTP_RANGE_NONE;
+			}
+			break;
+
+		case HTTP_RANGE_UNIT:
+			if(c == ' ' && http_range_matched == 0)
+			{
+				break;
+			}
+			if((c | 0x20) == http_range_unit[http_range_matched])
+			{
+				http_range_matched++;
+				if(http_range_matched == sizeof(http_range_unit)-1)
+				{
+					http_range_state = HTTP_RANGE_FIRST;
+					http_range_given = 0;
+					http_range_values[0] = 0;
+					http_range_values[1] = 0;
+				}
+			}
+			else
+			{
+				http_range_state = HTTP_RANGE_NONE;
+			}
+			break;
+
+		case HTTP_RANGE_FIRST:
+		case HTTP_RANGE_LAST:
+			i = http_range_state - HTTP_RANGE_FIRST;
+			if(c >= '0' && c <= '9')
+			{
+				/* Too large a number stays too large. */
+				http_range_values[i] = (http_range_values[i] > 6552) ? 0xFFFF :
+				                       http_range_values[i] * 10 + (c - '0');
+				http_range_given |= i ? HTTP_RANGE_GIVEN_LAST : HTTP_RANGE_GIVEN_FIRST;
+			}
+			else if(c == '-' && i == 0)
+			{
+				http_range_state = HTTP_RANGE_LAST;
+			}
+			else if(c != ' ' && c != '\r')
+			{
+				/* Several ranges, or garbage. */
+				http_range_state = HTTP_RANGE_NONE;
+			}
+			break;
+	}
+}
+/*-----------------------------------------------------------------------------------*/
+/* Make the range received one of the page and note it;
+   return 0 if it is none. */
+uint8_t http_range_note_set(void)
+{
+	uint16_t first = http_range_values[0];
+	uint16_t last = http_range_values[1];
+
+	if(!(http_range_given & HTTP_RANGE_GIVEN_FIRST))
+	{
+		/* The last bytes of the page. */
+		if(!(http_range_given & HTTP_RANGE_GIVEN_LAST) || last == 0)
+		{
+			return 0;
+		}
+		first = (last < http_welcomepage_length) ? http_welcomepage_length - last : 0;
+		last = http_welcomepage_length-1;
+	}
+	else if(!(http_range_given & HTTP_RANGE_GIVEN_LAST) || last >= http_welcomepage_length)
+	{
+		last = http_welcomepage_length-1;
+	}
+
+	/* A range which cannot be satisfied is ignored. */
+	if(first > last)
+	{
+		return 0;
+	}
+
+	http_note_set(HTTP_NOTE_FIRST, 2, first);
+	http_note_set(HTTP_NOTE_LAST, 2, last);
+	return 1;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Return 1 if one of the answers has a range already. */
+uint8_t http_range_noted(void)
+{
+	uint8_t i;
+
+	for(i = 1; i <= HTTP_ANSWERS; i++)
+	{
+		if(tcp_notes[i] & HTTP_ANSWER_RANGE)
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+#endif
+/*-----------------------------------------------------------------------------------*/
+/* Note an answer to the request which just ended. */
+void http_request_end(void)
+{
+	/* Requests after one which closes the connection are not answered;
+	   neither are those which do not fit into tcp_notes. The client
+	   has to repeat them over a new connection. */
+	if(tcp_close)
+	{
+		return;
+	}
+
+	if(HTTP_ANSWERS == HTTP_PIPELINE-1)
+	{
+		http_close = 1;
+	}
+
+	HTTP_ANSWERS++;
+	tcp_notes[HTTP_ANSWERS] = http_close ? HTTP_ANSWER_CLOSE : 0;
+	if(http_page)
+	{
+		/* Pages other than the welcome page are always sent whole. */
+		tcp_notes[HTTP_ANSWERS] |= http_page;
+	}
+#if HTTP_RANGE
+	else if(http_range && !http_range_noted() && http_range_note_set())
+	{
+		tcp_notes[HTTP_ANSWERS] |= HTTP_ANSWER_RANGE;
+	}
+#endif
+	tcp_close = http_close;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Count the requests noted, latch what their answers show and size
+   the answers. Called only for requests with correct checksum which
+   belong to a connection or bring a valid cookie. */
+void http_accept(void)
+{
+	uint8_t i;
+
+#if HTTP_VALUES
+	http_requests += HTTP_ANSWERS;
+	http_values_latch();
+#endif
+
+	tcp_data_length = 0;
+	for(i = 1; i <= HTTP_ANSWERS; i++)
+	{
+#if TIMING
+		if((tcp_notes[i] & HTTP_ANSWER_PAGE) == HTTP_ANSWER_METRICS)
+		{
+			http_timing_latch();
+		}
+#endif
+		tcp_data_length += http_answer_length(tcp_notes[i]);
+	}
+
+#if !TCP_CONNECTIONS
+	/* Without a connection table the answers go out in one
+	   segment; if they do not fit, the client is told so. */
+	if(tcp_data_length > TCP_MSS)
+	{
+		HTTP_ANSWERS = 1;
+		tcp_notes[1] = HTTP_ANSWER_UNAVAILABLE | HTTP_ANSWER_CLOSE;
+		tcp_data_length = http_answer_length(tcp_notes[1]);
+	}
+#endif
+}
+/*-----------------------------------------------------------------------------------*/
+/* Take back the count of requests accepted but not answered after all. */
+void http_withdraw(void)
+{
+#if HTTP_VALUES
+	http_requests -= HTTP_ANSWERS;
+#endif
+}
+/*-----------------------------------------------------------------------------------*/
+unsigned char http_server(server_stage stage, unsigned char c)
+{
+	uint16_t char_index;
+	uint16_t length;
+	uint8_t i;
+	
+	switch(stage)
+	{
+		case RECEIVING:
+			/* Every segment starts with a new request. */
+			if(byte_number == ip_packet_length - tcp_data_length + 1)
+			{
+				HTTP_ANSWERS = 0;
+				http_line_length = 0;
+				http_matched = 0;
+				http_request_line = 1;
+				http_close = 0;
+#if HTTP_RANGE
+				http_range = 0;
+#endif
+				http_page = 0;
+			}
+
+			if(c == '\n')
+			{
+				/* An empty line ends the request. */
+				if(http_line_length <= 1)
+				{
+					http_request_end();
+					http_request_line = 1;
+					http_close = 0;
+#if HTTP_RANGE
+					http_range = 0;
+#endif
+					http_page = 0;
+				}
+				else
+				{
+#if HTTP_RANGE
+					if(http_range_state == HTTP_RANGE_LAST && !http_request_line)
+					{
+						http_range = 1;
+					}
+#endif
+					http_request_line = 0;
+				}
+				http_line_length = 0;
+				http_matched = 0;
+#if HTTP_RANGE
+				http_range_state = HTTP_RANGE_NAME;
+				http_range_matched = 0;
+#endif
+			}
+			else
+			{
+				if(http_line_length < 0xFF)
+				{
+					http_line_length++;
+				}
+
+				if(http_request_line)
+				{
+					/* The request line ends with the HTTP version.
+					   HTTP/1.0 closes the connection after the answer. */
+					if(http_last == '.')
+					{
+						http_close = (c == '0');
+					}
+
+#if STATS
+					http_path_rx(c);
+#endif
+				}
+				else if(http_matched == http_line_length-1 &&
+				        http_matched < sizeof(http_connection)-1)
+				{
+					if((c | 0x20) == http_connection[http_matched])
+					{
+						http_matched++;
+					}
+				}
+				else if(http_matched == sizeof(http_connection)-1 && c != ' ')
+				{
+					/* Value of the Connection header. */
+					if((c | 0x20) == 'c')
+					{
+						http_close = 1;
+					}
+					http_matched = 0;
+				}
+
+#if HTTP_RANGE
+				if(!http_request_line)
+				{
+					http_range_rx(c);
+				}
+#endif
+			}
+			http_last = c;
+
+			/* At the end of the HTTP request specify length of the answer. */
+			if(byte_number == ip_packet_length)
+			{
+				/* Answer even a request without an empty line at the end. */
+				if(HTTP_ANSWERS == 0)
+				{
+					http_request_end();
+				}
+#if !TCP_CONNECTIONS
+				/* Without a connection table the connection is always closed. */
+				tcp_notes[HTTP_ANSWERS] |= HTTP_ANSWER_CLOSE;
+				tcp_close = 1;
+#endif
+
+				/* The answers are sized by http_accept(), once
+				   the request turns out to be genuine. */
+				tcp_data_length = 0;
+			}
+			break;
+
+		case SNAPSHOT:
+#if HTTP_PLACEHOLDERS
+			http_values_measure();
+#endif
+#if HTTP_SINGLE_PASS
+			return http_single_pass();
+#else
+			break;
+#endif
+			
+		case CHECKSUM:
+		
+		case SENDING:
+			char_index = byte_number - (IP_HEADER_LENGTH + tcp_header_length) + tcp_data_offset;
+			tcp_run_text = 1;
+
+			/* Pipelined requests are answered back to back. */
+			for(i = 1; i < HTTP_ANSWERS; i++)
+			{
+				length = http_answer_length(tcp_notes[i]);
+				if(char_index < length)
+				{
+					break;
+				}
+				char_index -= length;
+			}
+			http_answer(stage, tcp_notes[i], char_index);
+			break;
+	}
+	
+	return '\0';
+}
+#endif
+/*-----------------------------------------------------------------------------------*/
+
+#if MODBUS_SERVER
+
+/* Modbus infrastructure. */
+
+#define MODBUS_HDR_TRANSACTION_1 0
+#define MODBUS_HDR_TRANSACTION_2 1
+#define MODBUS_HDR_PROTOCOL_1 2
+#define MODBUS_HDR_PROTOCOL_2 3
+#define MODBUS_HDR_LENGTH_1 4
+#define MODBUS_HDR_LENGTH_2 5
+#define MODBUS_HDR_UNIT 6
+#define MODBUS_PDU_FUNCTION 7
+#define MODBUS_PDU_ADDRESS_1 8
+#define MODBUS_PDU_ADDRESS_2 9
+#define MODBUS_PDU_QUANTITY_1 10
+#define MODBUS_PDU_QUANTITY_2 11
+#define MODBUS_PDU_BYTE_COUNT 12
+#define MODBUS_PDU_VALUES 13
+
+#define MODBUS_HEADER_LENGTH 7
+
+enum modbus_function
+{
+	MODBUS_READ_COILS = 1,
+	MODBUS_READ_HOLDING_REGISTERS = 3,
+	MODBUS_WRITE_SINGLE_COIL = 5,
+	MODBUS_WRITE_SINGLE_REGISTER = 6,
+	MODBUS_WRITE_MULTIPLE_COILS = 15,
+	MODBUS_WRITE_MULTIPLE_REGISTERS = 16
+};
+
+#define MODBUS_NO_EXCEPTION 0
+#define MODBUS_ILLEGAL_FUNCTION 1
+#define MODBUS_ILLEGAL_DATA_ADDRESS 2
+#define MODBUS_ILLEGAL_DATA_VALUE 3
+#define MODBUS_EXCEPTION_FLAG 0x80
+
+/* Coils 0 to 31 are the pins of P0 to P3. */
+#define MODBUS_PORTS 4
+#define MODBUS_COILS (MODBUS_PORTS*8)
+
+/* Holding registers 0 to 3 are P0 to P3, the rest are general purpose. */
+#define MODBUS_GENERAL_REGISTERS 4
+#define MODBUS_REGISTERS (MODBUS_PORTS+MODBUS_GENERAL_REGISTERS)
+
+/* RXD and TXD are P3.0 and P3.1; never pull them low. With the
+   connection table in XRAM, P0 and P2 carry its address and data,
+   and P3.6 and P3.7 are /WR and /RD: writes leave them alone. */
+#if TCP_CONNECTIONS
+#define MODBUS_P3_RESERVED_PINS 0xC3
+#else
+#define MODBUS_P3_RESERVED_PINS 0x03
+#endif
+
+uint16_t modbus_transaction;
+uint16_t modbus_protocol;
+uint16_t modbus_length;
+uint8_t modbus_unit;
+uint8_t modbus_function;
+uint16_t modbus_address;
+uint16_t modbus_quantity;	/* Or the value of a single write. */
+uint8_t modbus_byte_count;
+uint8_t modbus_exception;
+
+/* Write requests are staged here until the TCP checksum is verified. */
+uint8_t modbus_values[MODBUS_REGISTERS*2];
+
+uint16_t modbus_registers[MODBUS_GENERAL_REGISTERS];
+
+/* The request is parsed into the variables above, which the next
+   segment overwrites. What the answer needs is latched into tcp_notes
+   at the end of the request, together with the pins of the ports,
+   so that every segment of the answer is generated from the same. */
+#define MODBUS_NOTE_TRANSACTION 0	/* 2 bytes. */
+#define MODBUS_NOTE_UNIT 2
+#define MODBUS_NOTE_FUNCTION 3
+#define MODBUS_NOTE_EXCEPTION 4
+#define MODBUS_NOTE_ADDRESS 5		/* 2 bytes. */
+#define MODBUS_NOTE_QUANTITY 7		/* 2 bytes. */
+#define MODBUS_NOTE_LENGTH 9		/* 2 bytes, length of the answer. */
+#define MODBUS_NOTE_PINS 11			/* MODBUS_PORTS bytes. */
+
+#if MODBUS_NOTE_PINS+MODBUS_PORTS != MODBUS_NOTES
+#error MODBUS_NOTES does not match the notes of the Modbus server
+#endif
+
+/*-----------------------------------------------------------------------------------*/
+uint8_t modbus_read_port(uint8_t port)
+{
+	switch(port)
+	{
+		case 0:
+			return P0;
+		case 1:
+			return P1;
+		case 2:
+			return P2;
+	}
+
+	return P3;
+}
+/*-----------------------------------------------------------------------------------*/
+void modbus_write_port(uint8_t port, uint8_t value)
+{
+	switch(port)
+	{
+#if !TCP_CONNECTIONS
+		case 0:
+			P0 = value;
+			break;
+		case 2:
+			P2 = value;
+			break;
+#endif
+		case 1:
+			P1 = value;
+			break;
+		case 3:
+			P3 = value | MODBUS_P3_RESERVED_PINS;
+			break;
+	}
+}
+/*-----------------------------------------------------------------------------------*/
+uint16_t modbus_note(uint8_t index)
+{
+	return ((uint16_t) tcp_notes[index]) << 8 | tcp_notes[index+1];
+}
+/*-----------------------------------------------------------------------------------*/
+void modbus_note_set(uint8_t index, uint16_t value)
+{
+	tcp_notes[index] = value >> 8;
+	tcp_notes[index+1] = value & 0xFF;
+}
+/*-----------------------------------------------------------------------------------*/
+uint8_t modbus_read_coil(uint16_t coil)
+{
+	return (tcp_notes[MODBUS_NOTE_PINS + (coil >> 3)] >> (coil & 0x7)) & 0x1;
+}
+/*-----------------------------------------------------------------------------------*/
+void modbus_write_coil(uint16_t coil, uint8_t value)
+{
+	uint8_t port = coil >> 3;
+	uint8_t mask = 1 << (coil & 0x7);
+
+	if(value)
+	{
+		modbus_write_port(port, modbus_read_port(port) | mask);
 	}
 	else
 	{
-		tcp_flags = TCP_FLAG_RST | TCP_FLAG_ACK;
-		SWAP(tcp_ack, tcp_seq);
-		tcp_ack++;
-		tcp_data_length = 0;
-		tcp_tx();
+		modbus_write_port(port, modbus_read_port(port) & ~mask);
 	}
 }
 /*-----------------------------------------------------------------------------------*/
-void tcp_tx(void)
+uint16_t modbus_read_register(uint16_t reg)
 {
-	#define TCP_TX_HEADER_LENGTH 20
+	if(reg < MODBUS_PORTS)
+	{
+		return tcp_notes[MODBUS_NOTE_PINS + reg];
+	}
 
-	uint16_t byte_number_backup;
+	return modbus_registers[reg - MODBUS_PORTS];
+}
+/*-----------------------------------------------------------------------------------*/
+void modbus_write_register(uint16_t reg, uint16_t value)
+{
+	if(reg < MODBUS_PORTS)
+	{
+		modbus_write_port(reg, value & 0xFF);
+	}
+	else
+	{
+		modbus_registers[reg - MODBUS_PORTS] = value;
+	}
+}
+/*-----------------------------------------------------------------------------------*/
+/* Check the request and return the length of the answer, or 0 if none. */
+uint16_t modbus_answer_length(uint16_t request_length)
+{
+	uint16_t objects = MODBUS_REGISTERS;
 
-	/* Adjust packet length. */
-	ip_packet_length = tcp_data_length + TCP_TX_HEADER_LENGTH;
-	
-	/* Transfer IP header. */
-	ip_tx();
+	/* Drop everything which is not one complete Modbus/TCP request. */
+	if(request_length < MODBUS_PDU_FUNCTION+1 ||
+	   modbus_protocol != 0 ||
+	   modbus_length != request_length - MODBUS_HDR_UNIT)
+	{
+		return 0;
+	}
 
-	/* Reinitialize TCP checksum. */
-	checksum = 0;
+	modbus_exception = MODBUS_NO_EXCEPTION;
 
- 	/* Add pseudo header. */
- 	add_pseudo_header_to_checksum();
+	switch(modbus_function)
+	{
+		case MODBUS_READ_COILS:
+		case MODBUS_WRITE_SINGLE_COIL:
+		case MODBUS_WRITE_MULTIPLE_COILS:
+			objects = MODBUS_COILS;
+			break;
 
- 	/* Transfer source port. */
- 	ip_tx2(tcp_local_port);
- 	
- 	/* Transfer destination port. */
- 	ip_tx2(tcp_remote_port);
- 	
- 	/* Transfer sequence number. */
- 	ip_tx2(tcp_seq >> 16);
- 	ip_tx2(tcp_seq & 0xFFFF);
- 	
- 	/* Transfer acknowledge number. */
- 	ip_tx2(tcp_ack >> 16);
- 	ip_tx2(tcp_ack & 0xFFFF);
- 	
- 	/* Transfer data offset. */
- 	ip_tx1(5 << 4);
- 	
- 	/* Transfer flags. */
- 	ip_tx1(tcp_flags);
- 	
- 	/* Transfer window size. */
- 	ip_tx2(0x2000);
+		case MODBUS_READ_HOLDING_REGISTERS:
+		case MODBUS_WRITE_SINGLE_REGISTER:
+		case MODBUS_WRITE_MULTIPLE_REGISTERS:
+			break;
 
- 	/* Calculate and transfer checksum. */
- 	if(ip_packet_length > IP_HEADER_LENGTH+TCP_TX_HEADER_LENGTH)	/* Only if there is a connection. */
- 	{
-	 	byte_number_backup = byte_number;
-	 	/* Advance to TCP data and calculate checksum. */
-	 	byte_number = byte_number + 4;
-	 	while(byte_number < ip_packet_length)
-	 	{
-			add_to_checksum(http_server(CHECKSUM, '\0'));
-			byte_number++;
- 		}
- 		byte_number = byte_number_backup;
+		default:
+			modbus_exception = MODBUS_ILLEGAL_FUNCTION;
+			return MODBUS_PDU_FUNCTION+2;
 	}
- 	ip_tx2(~resulting_checksum());
- 	
- 	/* Transfer urgent pointer. We need it not. Make it zero. */
- 	ip_tx2(0x0000);
 
- 	/* Transfer TCP data. */
- 	while(byte_number < ip_packet_length)
+	/* Check request length, quantity and value. */
+	if(modbus_function == MODBUS_WRITE_MULTIPLE_COILS ||
+	   modbus_function == MODBUS_WRITE_MULTIPLE_REGISTERS)
+	{
+		if(request_length != MODBUS_PDU_VALUES + modbus_byte_count)
+			modbus_exception = MODBUS_ILLEGAL_DATA_VALUE;
+	}
+	else if(request_length != MODBUS_PDU_QUANTITY_2+1)
 	{
-		ip_tx1(http_server(SENDING, '\0'));
+		modbus_exception = MODBUS_ILLEGAL_DATA_VALUE;
 	}
 
- 	/* End packet (SLIP). */
-	end_packet();
+	switch(modbus_function)
+	{
+		case MODBUS_READ_COILS:
+			if(modbus_quantity == 0 || modbus_quantity > 2000)
+				modbus_exception = MODBUS_ILLEGAL_DATA_VALUE;
+			break;
+
+		case MODBUS_READ_HOLDING_REGISTERS:
+			if(modbus_quantity == 0 || modbus_quantity > 125)
+				modbus_exception = MODBUS_ILLEGAL_DATA_VALUE;
+			break;
+
+		case MODBUS_WRITE_SINGLE_COIL:
+			if(modbus_quantity != 0x0000 && modbus_quantity != 0xFF00)
+				modbus_exception = MODBUS_ILLEGAL_DATA_VALUE;
+			break;
+
+		case MODBUS_WRITE_MULTIPLE_COILS:
+			if(modbus_quantity == 0 || modbus_quantity > 0x7B0 ||
+			   modbus_byte_count != (modbus_quantity + 7) >> 3)
+				modbus_exception = MODBUS_ILLEGAL_DATA_VALUE;
+			break;
+
+		case MODBUS_WRITE_MULTIPLE_REGISTERS:
+			if(modbus_quantity == 0 || modbus_quantity > 123 ||
+			   modbus_byte_count != modbus_quantity << 1)
+				modbus_exception = MODBUS_ILLEGAL_DATA_VALUE;
+			break;
+	}
+
+	/* Check address range. */
+	if(modbus_exception == MODBUS_NO_EXCEPTION)
+	{
+		if(modbus_function == MODBUS_WRITE_SINGLE_COIL ||
+		   modbus_function == MODBUS_WRITE_SINGLE_REGISTER)
+		{
+			if(modbus_address >= objects)
+				modbus_exception = MODBUS_ILLEGAL_DATA_ADDRESS;
+		}
+		else if(modbus_address >= objects ||
+		        modbus_quantity > objects - modbus_address)
+		{
+			modbus_exception = MODBUS_ILLEGAL_DATA_ADDRESS;
+		}
+	}
+
+	if(modbus_exception != MODBUS_NO_EXCEPTION)
+	{
+		return MODBUS_PDU_FUNCTION+2;
+	}
+
+	switch(modbus_function)
+	{
+		case MODBUS_READ_COILS:
+			return MODBUS_PDU_ADDRESS_2 + ((modbus_quantity + 7) >> 3);
+
+		case MODBUS_READ_HOLDING_REGISTERS:
+			return MODBUS_PDU_ADDRESS_2 + (modbus_quantity << 1);
+	}
+
+	/* Writes echo address and quantity or value. */
+	return MODBUS_PDU_QUANTITY_2+1;
 }
 /*-----------------------------------------------------------------------------------*/
+/* Perform staged writes. Called only for requests with correct checksum. */
+void modbus_execute(void)
+{
+	uint16_t i;
 
-/* HTTP infrastructure. */
+	if(tcp_data_length == 0 || modbus_exception != MODBUS_NO_EXCEPTION)
+	{
+		return;
+	}
 
+	switch(modbus_function)
+	{
+		case MODBUS_WRITE_SINGLE_COIL:
+			modbus_write_coil(modbus_address, modbus_quantity == 0xFF00);
+			break;
 
-const unsigned char welcomepage[] = "HTTP/1.0 200 OK\r\n"
-                                    "Content-type: text/html\r\n"
-                                    "Server: you would not know anyway\r\n"
-                                    "\r\n"
-                                    "<html>\r\n"
-                                    "<head>\r\n"
-                                    "<title>Welcome</title>\r\n"
-                                    "</head>\r\n"
-                                    "<body>\r\n"
-                                    "<h1>Welcome to the HTTPPONG server!</h1>\r\n"
-                                    "It seems to work indeed.\r\n"
-                                    "</body>\r\n"
-                                    "</html>\r\n";
+		case MODBUS_WRITE_SINGLE_REGISTER:
+			modbus_write_register(modbus_address, modbus_quantity);
+			break;
+
+		case MODBUS_WRITE_MULTIPLE_COILS:
+			for(i = 0; i < modbus_quantity; i++)
+			{
+				modbus_write_coil(modbus_address + i,
+				                  (modbus_values[i >> 3] >> (i & 0x7)) & 0x1);
+			}
+			break;
 
-void http_cgi(void)
+		case MODBUS_WRITE_MULTIPLE_REGISTERS:
+			for(i = 0; i < modbus_quantity; i++)
+			{
+				modbus_write_register(modbus_address + i,
+				                      ((uint16_t) modbus_values[i << 1]) << 8 |
+				                      modbus_values[(i << 1) + 1]);
+			}
+			break;
+	}
+}
+/*-----------------------------------------------------------------------------------*/
+/* Return the character at the index of the answer. */
+unsigned char modbus_answer(uint16_t char_index)
 {
+	uint16_t address = modbus_note(MODBUS_NOTE_ADDRESS);
+	uint16_t quantity = modbus_note(MODBUS_NOTE_QUANTITY);
+	uint8_t function = tcp_notes[MODBUS_NOTE_FUNCTION];
+	uint8_t exception = tcp_notes[MODBUS_NOTE_EXCEPTION];
+	uint16_t object;
+	unsigned char value;
+	uint8_t i;
+
+	switch(char_index)
+	{
+		case MODBUS_HDR_TRANSACTION_1:
+			return tcp_notes[MODBUS_NOTE_TRANSACTION];
+		case MODBUS_HDR_TRANSACTION_2:
+			return tcp_notes[MODBUS_NOTE_TRANSACTION+1];
+		case MODBUS_HDR_PROTOCOL_1:
+		case MODBUS_HDR_PROTOCOL_2:
+		case MODBUS_HDR_LENGTH_1:
+			return 0;
+		case MODBUS_HDR_LENGTH_2:
+			return modbus_note(MODBUS_NOTE_LENGTH) - MODBUS_HDR_UNIT;
+		case MODBUS_HDR_UNIT:
+			return tcp_notes[MODBUS_NOTE_UNIT];
+		case MODBUS_PDU_FUNCTION:
+			if(exception != MODBUS_NO_EXCEPTION)
+			{
+				return function | MODBUS_EXCEPTION_FLAG;
+			}
+			return function;
+	}
+
+	if(exception != MODBUS_NO_EXCEPTION)
+	{
+		return exception;
+	}
+
+	switch(function)
+	{
+		case MODBUS_READ_COILS:
+			if(char_index == MODBUS_PDU_ADDRESS_1)
+			{
+				return modbus_note(MODBUS_NOTE_LENGTH) - MODBUS_PDU_ADDRESS_2;
+			}
+			/* Pack up to eight coils into one byte. */
+			object = address + ((char_index - MODBUS_PDU_ADDRESS_2) << 3);
+			value = 0;
+			for(i = 0; i < 8 && object < address + quantity; i++, object++)
+			{
+				value |= modbus_read_coil(object) << i;
+			}
+			return value;
+
+		case MODBUS_READ_HOLDING_REGISTERS:
+			if(char_index == MODBUS_PDU_ADDRESS_1)
+			{
+				return modbus_note(MODBUS_NOTE_LENGTH) - MODBUS_PDU_ADDRESS_2;
+			}
+			char_index = char_index - MODBUS_PDU_ADDRESS_2;
+			object = modbus_read_register(address + (char_index >> 1));
+			if(char_index & 0x1)
+			{
+				return object & 0xFF;
+			}
+			return object >> 8;
+	}
+
+	/* Echo of a write request. */
+	switch(char_index)
+	{
+		case MODBUS_PDU_ADDRESS_1:
+			return address >> 8;
+		case MODBUS_PDU_ADDRESS_2:
+			return address & 0xFF;
+		case MODBUS_PDU_QUANTITY_1:
+			return quantity >> 8;
+	}
+	return quantity & 0xFF;
 }
 /*-----------------------------------------------------------------------------------*/
-unsigned char http_server(server_stage stage, unsigned char c)
+unsigned char modbus_server(server_stage stage, unsigned char c)
 {
 	uint16_t char_index;
-	
+	uint8_t i;
+
 	switch(stage)
 	{
 		case RECEIVING:
-			c=c;
-			/* At the end of the HTTP request specify length of the answer. Also do CGI. */
-		    if(byte_number == ip_packet_length-1)
-		    {
-			    http_cgi();
-			    tcp_data_length = sizeof(welcomepage);
-		    }
+			/* byte_number already points past the received character. */
+			char_index = byte_number - (ip_packet_length - tcp_data_length) - 1;
+
+			switch(char_index)
+			{
+				case MODBUS_HDR_TRANSACTION_1:
+				case MODBUS_HDR_TRANSACTION_2:
+					modbus_transaction = modbus_transaction << 8 | c;
+					break;
+
+				case MODBUS_HDR_PROTOCOL_1:
+				case MODBUS_HDR_PROTOCOL_2:
+					modbus_protocol = modbus_protocol << 8 | c;
+					break;
+
+				case MODBUS_HDR_LENGTH_1:
+				case MODBUS_HDR_LENGTH_2:
+					modbus_length = modbus_length << 8 | c;
+					break;
+
+				case MODBUS_HDR_UNIT:
+					modbus_unit = c;
+					break;
+
+				case MODBUS_PDU_FUNCTION:
+					modbus_function = c;
+					break;
+
+				case MODBUS_PDU_ADDRESS_1:
+				case MODBUS_PDU_ADDRESS_2:
+					modbus_address = modbus_address << 8 | c;
+					break;
+
+				case MODBUS_PDU_QUANTITY_1:
+				case MODBUS_PDU_QUANTITY_2:
+					modbus_quantity = modbus_quantity << 8 | c;
+					break;
+
+				case MODBUS_PDU_BYTE_COUNT:
+					modbus_byte_count = c;
+					break;
+
+				default:
+					char_index = char_index - MODBUS_PDU_VALUES;
+					if(char_index < sizeof(modbus_values))
+					{
+						modbus_values[char_index] = c;
+					}
+					break;
+			}
+
+			/* At the end of the request specify length of the answer,
+			   and note what it is generated from. */
+			if(byte_number == ip_packet_length)
+			{
+				tcp_data_length = modbus_answer_length(tcp_data_length);
+
+				modbus_note_set(MODBUS_NOTE_TRANSACTION, modbus_transaction);
+				tcp_notes[MODBUS_NOTE_UNIT] = modbus_unit;
+				tcp_notes[MODBUS_NOTE_FUNCTION] = modbus_function;
+				tcp_notes[MODBUS_NOTE_EXCEPTION] = modbus_exception;
+				modbus_note_set(MODBUS_NOTE_ADDRESS, modbus_address);
+				modbus_note_set(MODBUS_NOTE_QUANTITY, modbus_quantity);
+				modbus_note_set(MODBUS_NOTE_LENGTH, tcp_data_length);
+				for(i = 0; i < MODBUS_PORTS; i++)
+				{
+					tcp_notes[MODBUS_NOTE_PINS + i] = modbus_read_port(i);
+				}
+			}
 			break;
-			
+
+		case SNAPSHOT:
+			/* All is latched at the end of the request. */
+			break;
+
 		case CHECKSUM:
-		
+
 		case SENDING:
-			char_index = byte_number - (IP_HEADER_LENGTH + TCP_TX_HEADER_LENGTH);
-			return welcomepage[char_index];
+			char_index = byte_number - (IP_HEADER_LENGTH + tcp_header_length) + tcp_data_offset;
+
+			tcp_run_text = 0;
+
+			/* Fill the chunk, but do not read past the segment. */
+			for(i = 0; i < TCP_CHUNK_LENGTH && byte_number + i < ip_packet_length; i++)
+			{
+				tcp_chunk[i] = modbus_answer(char_index + i);
+			}
+			tcp_run = tcp_chunk;
+			tcp_run_length = i;
 			break;
 	}
-	
+
 	return '\0';
 }
+
+#endif
 /*-----------------------------------------------------------------------------------*/
 /*-----------------------------------------------------------------------------------*/
 void main(void)
 {	
+#if STACK_LAYER < STACK_IP
+	unsigned char c;
+#endif
+
+#if STATS
+	stats_stack_paint();
+#endif
+
 	/* Initialize UART. */
 	SCON = 0x50;	/* UART mode 1, receiver enabled. */
 	PCON |= 0x80;	/* Double baud rate. */
@@ -1083,18 +4431,71 @@ void main(void)
 	TH1 = 230;		/* Timer1 counter's initial value. */
 	TL1 = 230;		/* Calculated for 4800 baud @ 24 MHz, 2400 baud @ 12 MHz. */
 	TR1 = 1;		/* Run Timer1. */
+
+#if STACK_LAYER >= STACK_TCP
+	/* Initialize clock. */
+	TMOD |= 0x01;	/* 16 bit Timer0. */
+	TR0 = 1;		/* Run Timer0. */
+#endif
+
+#if TCP_CONNECTIONS && HTTP_SERVER
+	/* Index the pages for the checksum. */
+	http_index(welcomepage, WELCOMEPAGE_LENGTH, welcomepage_sums);
+#if STATS
+	http_index(metricspage, METRICSPAGE_LENGTH, metricspage_sums);
+#endif
+#endif
+
+#if HTTP_PLACEHOLDERS
+	/* The first answer is sized before any snapshot is taken. */
+	http_values_measure();
+#endif
 	
 	/* Enable interrupts. */
 	ES = 1;
+#if STACK_LAYER >= STACK_TCP
+	ET0 = 1;
+#endif
 	EA = 1;
 
+#if TIMING
+	timing_measure();
+#endif
+
+#if STACK_LAYER >= STACK_SLIP
 	/* Windows always send "CLIENT" and waits for "CLIENTSERVER\n".
 	  Other operating systems just connect. */
 	wait_for_slip_connection();
+#endif
 
 	/* Main loop. */
 	while(1)
 	{
+#if STACK_LAYER == STACK_UART
+		/* Type "ping" and see "pong". */
+		c = serial_rx_waiting();
+		serial_tx(c == 'i' ? 'o' : c);
+#elif STACK_LAYER == STACK_SLIP
+		/* Send every frame back, ending it where the received one ended. */
+		c = slip_decode(serial_rx_waiting());
+		if(slip_rx_state == SLIP_PACKET)
+		{
+			slip_tx(c);
+		}
+		else if(slip_rx_state == SLIP_IDLE && slip_tx_state == SLIP_PACKET)
+		{
+			end_packet();
+		}
+#else
+		TIMING_START();
+#if TCP_CONNECTIONS
+		/* Between packets, look after the retransmission timers while waiting.
+		   Within a packet they would overwrite what is being received. */
+		while(slip_rx_idle())
+		{
+			tcp_timer();
+		}
+#endif
 		ip_rx();
 
 		switch(ip_packet_protocol)
@@ -1109,9 +4510,12 @@ void main(void)
 				}
 				break;
 				
+#if STACK_LAYER >= STACK_TCP
 			case IP_PROTO_TCP:
 				tcp_rx();
 				break;
+#endif
 		}
+#endif
 	}
 }